@@ -1,5 +1,6 @@
 #include <inc/x86.h>
 #include <inc/elf.h>
+#include <inc/memlayout.h>
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
@@ -27,12 +28,17 @@
  *    and a stack so C code then run, then calls bootmain()
  *
  *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *
+ *  * bootmain() leaves the TSC at its start and after the kernel is
+ *    loaded at BOOTTSC_PADDR, so the kernel can report how long booting took.
  **********************************************************************/
 
 #define SECTSIZE	512
+#define MAXSECTS	256	// Most sectors one READ SECTORS command moves
 #define ELFHDR		((struct Elf *) 0x10000) // scratch space
+#define BOOTTSC		((uint64_t *) BOOTTSC_PADDR)
 
-void readsect(void*, uint32_t);
+void readsects(uint8_t*, uint32_t, uint32_t);
 void readseg(uint32_t, uint32_t, uint32_t);
 
 void
@@ -40,6 +46,8 @@ bootmain(void)
 {
 	struct Proghdr *ph, *eph;
 
+	BOOTTSC[0] = read_tsc();
+
 	// read 1st page off disk
 	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
 
@@ -55,6 +63,8 @@ bootmain(void)
 		// as the physical address)
 		readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
 
+	BOOTTSC[1] = read_tsc();
+
 	// call the entry point from the ELF header
 	// note: does not return!
     // last instruction bootloader execute
@@ -72,7 +82,7 @@ bad:
 void
 readseg(uint32_t pa, uint32_t count, uint32_t offset)
 {
-	uint32_t end_pa;
+	uint32_t end_pa, n;
 
 	end_pa = pa + count;
 	
@@ -82,17 +92,20 @@ readseg(uint32_t pa, uint32_t count, uint32_t offset)
 	// translate from bytes to sectors, and kernel starts at sector 1
 	offset = (offset / SECTSIZE) + 1;
 
-	// If this is too slow, we could read lots of sectors at a time.
+	// Read as many sectors per command as the disk allows.
 	// We'd write more to memory than asked, but it doesn't matter --
 	// we load in increasing order.
 	while (pa < end_pa) {
+		n = (end_pa - pa + SECTSIZE - 1) / SECTSIZE;
+		if (n > MAXSECTS)
+			n = MAXSECTS;
 		// Since we haven't enabled paging yet and we're using
 		// an identity segment mapping (see boot.S), we can
 		// use physical addresses directly.  This won't be the
 		// case once JOS enables the MMU.
-		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+		readsects((uint8_t*) pa, offset, n);
+		pa += n * SECTSIZE;
+		offset += n;
 	}
 }
 
@@ -104,23 +117,28 @@ waitdisk(void)
 		/* do nothing */;
 }
 
+// Read 'count' (1 to MAXSECTS) consecutive sectors starting at
+// 'offset' with a single command.
 void
-readsect(void *dst, uint32_t offset)
+readsects(uint8_t *dst, uint32_t offset, uint32_t count)
 {
 	// wait for disk to be ready
 	waitdisk();
 
-	outb(0x1F2, 1);		// count = 1
+	outb(0x1F2, count);	// count; 0 means MAXSECTS
 	outb(0x1F3, offset);
 	outb(0x1F4, offset >> 8);
 	outb(0x1F5, offset >> 16);
 	outb(0x1F6, (offset >> 24) | 0xE0);
 	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
 
-	// wait for disk to be ready
-	waitdisk();
+	// The disk raises DRQ for each sector in turn.
+	for (; count > 0; count--, dst += SECTSIZE) {
+		// wait for disk to be ready
+		waitdisk();
 
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+		// read a sector
+		insl(0x1F0, dst, SECTSIZE/4);
+	}
 }
 
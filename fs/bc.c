@@ -1,6 +1,23 @@
 
 #include "fs.h"
 
+// Most blocks a single IDE command can transfer (256 sectors).
+#define BC_MAXRUN	(256 / BLKSECTS)
+
+// Most IDE requests bc_flush and bc_prefetch queue at once.
+#define BC_NREQ		8
+
+// The blocks in the cache, one per slot, in the order bc_evict's CLOCK
+// hand visits them; 0 marks a free slot.
+static uint32_t bc_slots[BCACHE_NPAGES];
+static uint32_t bc_freeslots[BCACHE_NPAGES];
+static uint32_t bc_nfree, bc_hand;
+
+// Blocks that are never evicted: the superblock, the bitmap and
+// directory blocks, which nearly every request touches.
+static uint32_t bc_pins[BCACHE_NPINS];
+static uint32_t bc_npins;
+
 // Return the virtual address of this disk block.
 void*
 diskaddr(uint32_t blockno)
@@ -24,6 +41,91 @@ va_is_dirty(void *va)
 	return (vpt[PGNUM(va)] & PTE_D) != 0;
 }
 
+// Keep the block at va in the cache until bc_unpin.  Once
+// BCACHE_NPINS blocks are pinned, further blocks are cached like any
+// other.
+void
+bc_pin(void *va)
+{
+	uint32_t blockno = ((uint32_t) va - DISKMAP) / BLKSIZE, i;
+
+	for (i = 0; i < bc_npins; i++)
+		if (bc_pins[i] == blockno)
+			return;
+	if (bc_npins < BCACHE_NPINS)
+		bc_pins[bc_npins++] = blockno;
+}
+
+// Let the block at va be evicted again.  free_block calls this for
+// every block it frees, so a directory block that is freed and reused
+// for file data does not stay pinned.
+void
+bc_unpin(void *va)
+{
+	uint32_t blockno = ((uint32_t) va - DISKMAP) / BLKSIZE, i;
+
+	for (i = 0; i < bc_npins; i++)
+		if (bc_pins[i] == blockno) {
+			bc_pins[i] = bc_pins[--bc_npins];
+			return;
+		}
+}
+
+static bool
+bc_is_pinned(uint32_t blockno)
+{
+	uint32_t i;
+
+	for (i = 0; i < bc_npins; i++)
+		if (bc_pins[i] == blockno)
+			return 1;
+	return 0;
+}
+
+// Evict blocks until at least 'n' cache slots are free, choosing the
+// victims with the CLOCK algorithm: the hand sweeps the slots, and a
+// block whose PTE_A is set gets a second chance, with PTE_A cleared
+// (which also cleans it, so a dirty block is written back first).  A
+// victim that is dirty is written back before it is unmapped.
+static void
+bc_evict(uint32_t n)
+{
+	uint32_t slot, blockno, scanned = 0;
+	void *va;
+
+	while (bc_nfree < n) {
+		if (scanned++ > 2 * BCACHE_NPAGES)
+			panic("block cache: no block to evict");
+		slot = bc_hand;
+		bc_hand = (bc_hand + 1) % BCACHE_NPAGES;
+		if (!(blockno = bc_slots[slot]) || bc_is_pinned(blockno))
+			continue;
+
+		va = diskaddr(blockno);
+		if (va_is_mapped(va)) {
+			if (vpt[PGNUM(va)] & PTE_A) {
+				if (va_is_dirty(va))
+					bc_flush(blockno, 1);
+				else
+					sys_page_protect(0, va, BLKSIZE, PTE_URW);
+				continue;
+			}
+			bc_flush(blockno, 1);
+			sys_page_unmap(0, va);
+		}
+		bc_slots[slot] = 0;
+		bc_freeslots[bc_nfree++] = slot;
+	}
+}
+
+// Record that 'blockno' is now in the cache.  The caller has made
+// room with bc_evict.
+static void
+bc_insert(uint32_t blockno)
+{
+	bc_slots[bc_freeslots[--bc_nfree]] = blockno;
+}
+
 // Fault any disk block that is read or written in to memory by
 // loading it from disk.
 // Hint: Use ide_read and BLKSECTS.
@@ -50,10 +152,20 @@ bc_pgfault(struct UTrapframe *utf)
 	//
 	// LAB 5: Your code here
     void* va_beg = (void*)ROUNDDOWN((uint32_t)addr, BLKSIZE);
-    if ((r = sys_page_alloc(0, va_beg, PTE_URW)) < 0)
-      panic("sys_page_alloc: %e", r);
-    ide_read(blockno*BLKSECTS, addr, BLKSECTS); // what's secno?
-    sys_page_map(0, va_beg, 0, va_beg, PTE_URW); //clear dirty
+    bc_evict(1);
+    if (va_is_mapped(va_beg)) {
+      // The kernel has mapped a fresh page here and at BCFILL (see
+      // bc_init); reading through BCFILL leaves it clean, so a miss
+      // costs no system calls.
+      if ((r = ide_read(blockno*BLKSECTS, (void*)BCFILL, BLKSECTS)) < 0)
+        panic("ide_read: %e", r);
+    } else {
+      if ((r = sys_page_alloc(0, va_beg, PTE_URW)) < 0)
+        panic("sys_page_alloc: %e", r);
+      ide_read(blockno*BLKSECTS, va_beg, BLKSECTS); // what's secno?
+      sys_page_protect(0, va_beg, BLKSIZE, PTE_URW); //clear dirty
+    }
+    bc_insert(blockno);
     
 	// Check that the block we read was allocated. (exercise for
 	// the reader: why do we do this *after* reading the block
@@ -63,26 +175,130 @@ bc_pgfault(struct UTrapframe *utf)
 }
 
 // Flush the contents of the block containing VA out to disk if
-// necessary, then clear the PTE_D bit using sys_page_map.
+// necessary, and mark it clean.
 // If the block is not in the block cache or is not dirty, does
 // nothing.
-// Hint: Use va_is_mapped, va_is_dirty, and ide_write.
-// Hint: Use the PTE_SYSCALL constant when calling sys_page_map.
-// Hint: Don't forget to round addr down.
 void
 flush_block(void *addr)
 {
-	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
-
 	if (addr < (void*)DISKMAP || addr >= (void*)(DISKMAP + DISKSIZE))
 		panic("flush_block of bad va %08x", addr);
 
-	// LAB 5: Your code here.
-    void* va_beg = (void*)ROUNDDOWN((uint32_t)addr, BLKSIZE);
-    if (va_is_mapped(va_beg) && va_is_dirty(va_beg)) {
-      ide_write(blockno*BLKSECTS, addr, BLKSECTS);
-      sys_page_map(0, va_beg, 0, va_beg, PTE_URW); //clear dirty
-    } 
+	bc_flush((uint32_t) (addr - DISKMAP) / BLKSIZE, 1);
+}
+
+static bool
+bc_is_dirty(uint32_t blockno)
+{
+	void *va = diskaddr(blockno);
+
+	return va_is_mapped(va) && va_is_dirty(va);
+}
+
+// Wait for the first 'n' requests in 'reqs' and mark the blocks they
+// transferred clean.
+static void
+bc_wait(struct IdeReq *reqs, int n)
+{
+	int i, r;
+
+	for (i = 0; i < n; i++) {
+		if ((r = ide_wait(&reqs[i])) < 0)
+			panic("ide_%s: %e", reqs[i].ir_write ? "write" : "read", r);
+		sys_page_protect(0, reqs[i].ir_buf,
+				 reqs[i].ir_nsecs * SECTSIZE, PTE_URW);	// clear dirty
+	}
+}
+
+static void
+bc_submit(struct IdeReq *req, uint32_t blockno, uint32_t run, bool write)
+{
+	req->ir_secno = blockno * BLKSECTS;
+	req->ir_buf = diskaddr(blockno);
+	req->ir_nsecs = run * BLKSECTS;
+	req->ir_write = write;
+	ide_submit(req);
+}
+
+// Write out the dirty blocks among the 'n' blocks from 'blockno' on
+// and mark them clean.  Each run of consecutive dirty blocks goes to
+// the disk in one IDE command and is marked clean with one system
+// call; up to BC_NREQ runs are queued on the drive at once.  Ranges
+// without a page table are skipped a page table at a time.
+void
+bc_flush(uint32_t blockno, uint32_t n)
+{
+	struct IdeReq reqs[BC_NREQ];
+	uint32_t end = blockno + n, run;
+	int nreq = 0;
+
+	if (super && end > super->s_nblocks)
+		end = super->s_nblocks;
+	while (blockno < end) {
+		if (!(vpd[PDX(diskaddr(blockno))] & PTE_P)) {
+			blockno = ROUNDUP(blockno + 1, NPTENTRIES);
+			continue;
+		}
+		if (!bc_is_dirty(blockno)) {
+			blockno++;
+			continue;
+		}
+		for (run = 1; run < BC_MAXRUN && blockno + run < end &&
+			      bc_is_dirty(blockno + run); run++)
+			;
+		if (nreq == BC_NREQ) {
+			bc_wait(reqs, nreq);
+			nreq = 0;
+		}
+		bc_submit(&reqs[nreq++], blockno, run, 1);
+		blockno += run;
+	}
+	bc_wait(reqs, nreq);
+}
+
+// Read the blocks among the 'n' blocks from 'blockno' on that aren't
+// in the cache yet into it, so that they won't fault when they're
+// touched.  Each run of consecutive missing blocks costs one IDE
+// command and two system calls, instead of a fault per block, and
+// the runs are queued on the drive together.  At most a quarter of
+// the cache is read ahead at once; room for all of it is made before
+// any request goes out, so eviction never touches a page the drive
+// is still filling.
+void
+bc_prefetch(uint32_t blockno, uint32_t n)
+{
+	struct IdeReq reqs[BC_NREQ];
+	uint32_t end = blockno + n, b, run, want = 0;
+	int i, nreq = 0, r;
+
+	if (super && end > super->s_nblocks)
+		end = super->s_nblocks;
+	for (b = blockno; b < end && want < BCACHE_NPAGES / 4; b++)
+		if (!va_is_mapped(diskaddr(b)))
+			want++;
+	bc_evict(want);
+
+	while (blockno < end && want > 0 && nreq < BC_NREQ) {
+		if (va_is_mapped(diskaddr(blockno))) {
+			blockno++;
+			continue;
+		}
+		for (run = 1; run < BC_MAXRUN && run < want &&
+			      blockno + run < end &&
+			      !va_is_mapped(diskaddr(blockno + run)); run++)
+			;
+		if ((r = sys_page_alloc_range(0, diskaddr(blockno),
+					      run * BLKSIZE, PTE_URW)) < 0)
+			panic("sys_page_alloc_range: %e", r);
+		bc_submit(&reqs[nreq++], blockno, run, 0);
+		blockno += run;
+		want -= run;
+	}
+
+	bc_wait(reqs, nreq);
+	for (i = 0; i < nreq; i++)
+		for (b = 0; b < reqs[i].ir_nsecs / BLKSECTS; b++)
+			bc_insert(reqs[i].ir_secno / BLKSECTS + b);
 }
 
 // Test that the block cache works, by smashing the superblock and
@@ -118,6 +334,12 @@ check_bc(void)
 void
 bc_init(void)
 {
+	int r;
+
+	for (bc_nfree = 0; bc_nfree < BCACHE_NPAGES; bc_nfree++)
+		bc_freeslots[bc_nfree] = BCACHE_NPAGES - 1 - bc_nfree;
+	if ((r = sys_env_set_fault_fill(0, (void*) DISKMAP, DISKSIZE, (void*) BCFILL)) < 0)
+		panic("sys_env_set_fault_fill: %e", r);
 	set_pgfault_handler(bc_pgfault);
 	check_bc();
 }
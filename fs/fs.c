@@ -43,37 +43,55 @@ free_block(uint32_t blockno)
 	if (blockno == 0)
 		panic("attempt to free zero block");
 	bitmap[blockno/32] |= 1<<(blockno%32);
+	bc_unpin(diskaddr(blockno));
 }
 
-// Search the bitmap for a free block and allocate it.  When you
-// allocate a block, immediately flush the changed bitmap block
-// to disk.
+// Return the first free block in [start, end), or 0 if there is none
+// (block 0 is never free).  Bitmap words with no free blocks in them
+// are skipped whole.
+static uint32_t
+find_free_block(uint32_t start, uint32_t end)
+{
+	uint32_t b;
+
+	for (b = start; b < end; b++) {
+		if (bitmap[b / 32] == 0) {
+			b |= 31;
+			continue;
+		}
+		if (bitmap[b / 32] & (1 << (b % 32)))
+			return b;
+	}
+	return 0;
+}
+
+// Search the bitmap for a free block and allocate it, preferring
+// 'goal' and then the blocks after it, so that a file grown one block
+// at a time still ends up contiguous on disk.  When you allocate a
+// block, immediately flush the changed bitmap block to disk.
 //
 // Return block number allocated on success,
 // -E_NO_DISK if we are out of blocks.
-//
-// Hint: use free_block as an example for manipulating the bitmap.
+int
+alloc_block_near(uint32_t goal)
+{
+	uint32_t b;
+
+	if (goal >= super->s_nblocks)
+		goal = 0;
+	if (!(b = find_free_block(goal, super->s_nblocks)) &&
+	    !(b = find_free_block(0, goal)))
+		return -E_NO_DISK;
+	bitmap[b / 32] &= ~(1 << (b % 32));
+	flush_block(diskaddr(2 + b / BLKBITSIZE));
+	return b;
+}
+
+// Allocate any free block; see alloc_block_near.
 int
 alloc_block(void)
 {
-	// The bitmap consists of one or more blocks.  A single bitmap block
-	// contains the in-use bits for BLKBITSIZE blocks.  There are
-	// super->s_nblocks blocks in the disk altogether.
-
-	// LAB 5: Your code here.
-  uint32_t i;
-  // shall I skip block 1,2,bitmap, manually
-  // bitmap is set when free and clear when use
-  for (i = 0; i < super->s_nblocks; i++) {
-    if (block_is_free(i)) {
-      //cprintf("before bitmap[0] %x\n", bitmap[i/32]);
-      bitmap[i/32] &= ~(1<<(i%32));
-      flush_block(diskaddr(2+i/BLKBITSIZE));
-      //cprintf("after bitmap[0] %x, bitmap %d\n", bitmap[i/32], 2+i/BLKBITSIZE);
-      return i;
-    }
-  }
-  return -E_NO_DISK;
+	return alloc_block_near(0);
 }
 
 // Validate the file system bitmap.
@@ -104,6 +122,8 @@ check_bitmap(void)
 void
 fs_init(void)
 {
+	uint32_t i;
+
 	static_assert(sizeof(struct File) == 256);
 
 	// Find a JOS disk.  Use the second IDE disk (number 1) if available.
@@ -121,50 +141,121 @@ fs_init(void)
 
 	check_super();
 	check_bitmap();
+
+	// Every request needs these; keep them cached.
+	bc_pin(super);
+	for (i = 0; i * BLKBITSIZE < super->s_nblocks; i++)
+		bc_pin(diskaddr(2 + i));
 }
 
-// Find the disk block number slot for the 'filebno'th block in file 'f'.
-// Set '*ppdiskbno' to point to that slot.
-// The slot will be one of the f->f_direct[] entries,
-// or an entry in the indirect block.
-// When 'alloc' is set, this function will allocate an indirect block
+// Allocate a zeroed block for f's block map, near 'goal'.
+static int
+alloc_map_block(uint32_t goal)
+{
+	int r;
+
+	if ((r = alloc_block_near(goal)) < 0)
+		return r;
+	memset(diskaddr(r), 0, BLKSIZE);
+	return r;
+}
+
+// Find entry 'mapbno' of f's double-indirect block map and store the
+// disk block it maps in *pdiskbno, or 0 if there is none.  When
+// 'alloc' is set, allocate the block, and any map blocks on the way,
 // if necessary.
+// Returns the number of map entries from mapbno on that are
+// contiguous on disk, or < 0 on error (see file_block_walk).
+static int
+file_map_walk(struct File *f, uint32_t mapbno, uint32_t *pdiskbno, bool alloc)
+{
+	uint32_t *dind, *ind, goal, k = mapbno % NINDIRECT;
+	int n, r;
+
+	if (mapbno >= NINDIRECT * NINDIRECT)
+		return -E_INVAL;
+	if (!f->f_dindirect) {
+		if (!alloc)
+			return -E_NOT_FOUND;
+		if ((r = alloc_map_block(0)) < 0)
+			return r;
+		f->f_dindirect = r;
+	}
+	dind = diskaddr(f->f_dindirect);
+	if (!dind[mapbno / NINDIRECT]) {
+		if (!alloc)
+			return -E_NOT_FOUND;
+		if ((r = alloc_map_block(f->f_dindirect + 1)) < 0)
+			return r;
+		dind[mapbno / NINDIRECT] = r;
+	}
+	ind = diskaddr(dind[mapbno / NINDIRECT]);
+	if (!ind[k] && alloc) {
+		goal = k && ind[k - 1] ? ind[k - 1] + 1 : dind[mapbno / NINDIRECT] + 1;
+		if ((r = alloc_block_near(goal)) < 0)
+			return r;
+		ind[k] = r;
+	}
+
+	*pdiskbno = ind[k];
+	for (n = 1; *pdiskbno && k + n < NINDIRECT && ind[k + n] == *pdiskbno + n; n++)
+		;
+	return n;
+}
+
+// Find the disk block holding the 'filebno'th block of file 'f' and
+// store its number in '*pdiskbno', or 0 if the block isn't allocated.
+// When 'alloc' is set, allocate the block if necessary: a block
+// appended right after the extents grows the last extent if the disk
+// block after it is free, or else starts a new extent; any other new
+// block goes into the double-indirect map.
 //
 // Returns:
-//	0 on success (but note that *ppdiskbno might equal 0).
-//	-E_NOT_FOUND if the function needed to allocate an indirect block, but
+//	The number of file blocks from filebno on that are contiguous on
+//		disk (at least 1), so callers can do one large I/O.
+//	-E_NOT_FOUND if the function needed to allocate a map block, but
 //		alloc was 0.
-//	-E_NO_DISK if there's no space on the disk for an indirect block.
-//	-E_INVAL if filebno is out of range (it's >= NDIRECT + NINDIRECT).
+//	-E_NO_DISK if there's no space on the disk.
+//	-E_INVAL if filebno is out of range.
 //
 // Analogy: This is like pgdir_walk for files.
-// Hint: Don't forget to clear any block you allocate.???
 static int
-file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool alloc)
+file_block_walk(struct File *f, uint32_t filebno, uint32_t *pdiskbno, bool alloc)
 {
-  // LAB 5: Your code here.
-  int r;
-  
-  // [NDIRECT + NINDIRECT, inf]
-  if (filebno >= NDIRECT + NINDIRECT)
-    return -E_INVAL;
-  // [NDIRECT, NDIRECT + NINDIRECT)
-  if (filebno >= NDIRECT) {
-    if (f->f_indirect==0) {
-      if(alloc==0)
-        return -E_NOT_FOUND;
-      else {
-        if ((r = alloc_block()) == -E_NO_DISK)
-          return -E_NO_DISK;
-        f->f_indirect = r;
-        memset(diskaddr(f->f_indirect), 0, BLKSIZE);
-      }
-    }
-    *ppdiskbno = (uint32_t*)diskaddr(f->f_indirect) + filebno - NDIRECT;   
-  }
-  // [0, NDIRECT)
-  *ppdiskbno = &f->f_direct[filebno]; 
-  return 0;
+	struct Extent *ex = f->f_extents, *last;
+	uint32_t base = 0, goal;
+	int i, r;
+
+	for (i = 0; i < NEXTENT && ex[i].ex_nblocks; i++) {
+		if (filebno - base < ex[i].ex_nblocks) {
+			*pdiskbno = ex[i].ex_start + filebno - base;
+			return ex[i].ex_nblocks - (filebno - base);
+		}
+		base += ex[i].ex_nblocks;
+	}
+
+	// The extents can only grow while the block map is empty.
+	if (filebno != base || f->f_dindirect)
+		return file_map_walk(f, filebno - base, pdiskbno, alloc);
+	if (!alloc) {
+		*pdiskbno = 0;
+		return 1;
+	}
+
+	last = i ? &ex[i - 1] : NULL;
+	goal = last ? last->ex_start + last->ex_nblocks : 0;
+	if (i == NEXTENT && !block_is_free(goal))
+		return file_map_walk(f, 0, pdiskbno, alloc);
+	if ((r = alloc_block_near(goal)) < 0)
+		return r;
+	if (last && r == goal)
+		last->ex_nblocks++;
+	else {
+		ex[i].ex_start = r;
+		ex[i].ex_nblocks = 1;
+	}
+	*pdiskbno = r;
+	return 1;
 }
 
 // Set *blk to the address in memory where the filebno'th
@@ -174,25 +265,16 @@ file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool all
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_NO_DISK if a block needed to be allocated but the disk is full.
 //	-E_INVAL if filebno is out of range.
-//
-// Hint: Use file_block_walk and alloc_block.
 int
 file_get_block(struct File *f, uint32_t filebno, char **blk)
 {
-  // LAB 5: Your code here.
-  uint32_t* pdiskbno;
-  int r; 
-
-  if ((r = file_block_walk(f, filebno, &pdiskbno, 1)) != 0)
-    return r;
-  
-  if (*pdiskbno == 0) {
-    if((r = alloc_block()) < 0) return r;
-    *pdiskbno = r;
-  } 
-  
-  *blk = diskaddr(*pdiskbno);
-  return 0;
+	uint32_t diskbno;
+	int r;
+
+	if ((r = file_block_walk(f, filebno, &diskbno, 1)) < 0)
+		return r;
+	*blk = diskaddr(diskbno);
+	return 0;
 }
 
 // Try to find a file named "name" in dir.  If so, set *file to it.
@@ -215,6 +297,7 @@ dir_lookup(struct File *dir, const char *name, struct File **file)
 	for (i = 0; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
 			return r;
+		bc_pin(blk);
 		f = (struct File*) blk;
 		for (j = 0; j < BLKFILES; j++)
 			if (strcmp(f[j].f_name, name) == 0) {
@@ -240,6 +323,7 @@ dir_alloc_file(struct File *dir, struct File **file)
 	for (i = 0; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
 			return r;
+		bc_pin(blk);
 		f = (struct File*) blk;
 		for (j = 0; j < BLKFILES; j++)
 			if (f[j].f_name[0] == '\0') {
@@ -383,6 +467,27 @@ file_read(struct File *f, void *buf, size_t count, off_t offset)
 	return count;
 }
 
+// Bring blocks [filebno, filebno+n) of f into the block cache, a
+// contiguous run of disk blocks at a time (see bc_prefetch).  Blocks
+// past the end of the file or not allocated are skipped.
+void
+file_prefetch(struct File *f, uint32_t filebno, uint32_t n)
+{
+	uint32_t end, diskbno;
+	int r;
+
+	end = MIN(filebno + n, (f->f_size + BLKSIZE - 1) / BLKSIZE);
+	for (; filebno < end; filebno += r) {
+		if ((r = file_block_walk(f, filebno, &diskbno, 0)) < 0) {
+			r = 1;
+			continue;
+		}
+		r = MIN(r, end - filebno);
+		if (diskbno)
+			bc_prefetch(diskbno, r);
+	}
+}
+
 // Write count bytes from buf into f, starting at seek position
 // offset.  This is meant to mimic the standard pwrite function.
 // Extends the file if necessary.
@@ -411,47 +516,62 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 	return count;
 }
 
-// Remove a block from file f.  If it's not there, just silently succeed.
-// Returns 0 on success, < 0 on error.
-static int
-file_free_block(struct File *f, uint32_t filebno)
+// Free the disk blocks [start, start+n).
+static void
+free_blocks(uint32_t start, uint32_t n)
 {
-	int r;
-	uint32_t *ptr;
-
-	if ((r = file_block_walk(f, filebno, &ptr, 0)) < 0)
-		return r;
-	if (*ptr) {
-		free_block(*ptr);
-		*ptr = 0;
-	}
-	return 0;
+	while (n-- > 0)
+		free_block(start++);
 }
 
 // Remove any blocks currently used by file 'f',
-// but not necessary for a file of size 'newsize'.
-// For both the old and new sizes, figure out the number of blocks required,
-// and then clear the blocks from new_nblocks to old_nblocks.
-// If the new_nblocks is no more than NDIRECT, and the indirect block has
-// been allocated (f->f_indirect != 0), then free the indirect block too.
-// (Remember to clear the f->f_indirect pointer so you'll know
-// whether it's valid!)
+// but not necessary for a file of size 'newsize':
+// trim the extents, clear the block map entries past the new end,
+// and free any map blocks that no longer map anything.
 // Do not change f->f_size.
 static void
 file_truncate_blocks(struct File *f, off_t newsize)
 {
-	int r;
-	uint32_t bno, old_nblocks, new_nblocks;
+	struct Extent *ex;
+	uint32_t new_nblocks, base = 0, *dind, *ind, bno;
+	int i, j, k;
 
-	old_nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
 	new_nblocks = (newsize + BLKSIZE - 1) / BLKSIZE;
-	for (bno = new_nblocks; bno < old_nblocks; bno++)
-		if ((r = file_free_block(f, bno)) < 0)
-			cprintf("warning: file_free_block: %e", r);
+	for (i = 0; i < NEXTENT && f->f_extents[i].ex_nblocks; i++) {
+		ex = &f->f_extents[i];
+		if (base >= new_nblocks) {
+			free_blocks(ex->ex_start, ex->ex_nblocks);
+			ex->ex_start = ex->ex_nblocks = 0;
+		} else if (base + ex->ex_nblocks > new_nblocks) {
+			free_blocks(ex->ex_start + new_nblocks - base,
+				    base + ex->ex_nblocks - new_nblocks);
+			ex->ex_nblocks = new_nblocks - base;
+		}
+		base += ex->ex_nblocks;
+	}
 
-	if (new_nblocks <= NDIRECT && f->f_indirect) {
-		free_block(f->f_indirect);
-		f->f_indirect = 0;
+	if (!f->f_dindirect)
+		return;
+	dind = diskaddr(f->f_dindirect);
+	for (j = 0; j < NINDIRECT; j++) {
+		if (!dind[j])
+			continue;
+		ind = diskaddr(dind[j]);
+		for (k = 0; k < NINDIRECT; k++) {
+			bno = base + j * NINDIRECT + k;
+			if (bno >= new_nblocks && ind[k]) {
+				free_block(ind[k]);
+				ind[k] = 0;
+			}
+		}
+		if (base + j * NINDIRECT >= new_nblocks) {
+			free_block(dind[j]);
+			dind[j] = 0;
+		}
+	}
+	if (base >= new_nblocks) {
+		free_block(f->f_dindirect);
+		f->f_dindirect = 0;
 	}
 }
 
@@ -467,24 +587,32 @@ file_set_size(struct File *f, off_t newsize)
 }
 
 // Flush the contents and metadata of file f out to disk.
-// Loop over all the blocks in file.
-// Translate the file block number into a disk block number
-// and then check whether that disk block is dirty.  If so, write it out.
+// Loop over the runs of contiguous blocks in the file, and write out
+// the dirty blocks in each with as few IDE commands as possible (see
+// bc_flush), then the file's map blocks.
 void
 file_flush(struct File *f)
 {
-	int i;
-	uint32_t *pdiskbno;
+	uint32_t bno, diskbno, nblocks, *dind;
+	int i, n;
 
-	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
-		if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-		    pdiskbno == NULL || *pdiskbno == 0)
+	nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
+	for (bno = 0; bno < nblocks; bno += n) {
+		if ((n = file_block_walk(f, bno, &diskbno, 0)) < 0 || !diskbno) {
+			n = 1;
 			continue;
-		flush_block(diskaddr(*pdiskbno));
+		}
+		n = MIN(n, nblocks - bno);
+		bc_flush(diskbno, n);
 	}
 	flush_block(f);
-	if (f->f_indirect)
-		flush_block(diskaddr(f->f_indirect));
+	if (f->f_dindirect) {
+		dind = diskaddr(f->f_dindirect);
+		for (i = 0; i < NINDIRECT; i++)
+			if (dind[i])
+				flush_block(diskaddr(dind[i]));
+		flush_block(dind);
+	}
 }
 
 // Remove a file by truncating it and then zeroing the name.
@@ -509,8 +637,6 @@ file_remove(const char *path)
 void
 fs_sync(void)
 {
-	int i;
-	for (i = 1; i < super->s_nblocks; i++)
-		flush_block(diskaddr(i));
+	bc_flush(1, super->s_nblocks - 1);
 }
 
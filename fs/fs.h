@@ -11,20 +11,53 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE	0xC0000000
 
+/* Where the kernel also maps a block-cache page it has just allocated
+ * for a fault, so bc_pgfault can read the block in without dirtying it
+ * (see sys_env_set_fault_fill). */
+#define BCFILL		(DISKMAP + DISKSIZE)
+
+/* Most blocks the block cache keeps mapped at once; the least
+ * recently used ones are evicted beyond that (see bc_evict). */
+#define BCACHE_NPAGES	256
+
+/* Most blocks that can be pinned in the block cache at once. */
+#define BCACHE_NPINS	64
+
 struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
 
+/* A disk request, queued with ide_submit. */
+struct IdeReq {
+	uint32_t ir_secno;		// First sector
+	void *ir_buf;			// Data to write, or buffer to read into
+	uint32_t ir_nsecs;		// Sectors to transfer (at most 256)
+	bool ir_write;			// Write, rather than read
+	// Filled in by the driver
+	bool ir_dma;			// Bus master DMA, rather than PIO
+	uint32_t ir_ndone;		// Sectors transferred so far
+	int ir_result;			// > 0 until done, then 0 or < 0
+	uint64_t ir_cycles;		// Latency, once done (TSC cycles)
+	struct IdeReq *ir_next;		// Next in the driver's queue
+};
+
 /* ide.c */
 bool	ide_probe_disk1(void);
 void	ide_set_disk(int diskno);
+void	ide_submit(struct IdeReq *req);
+int	ide_wait(struct IdeReq *req);
 int	ide_read(uint32_t secno, void *dst, size_t nsecs);
 int	ide_write(uint32_t secno, const void *src, size_t nsecs);
+void	ide_report(void);
 
 /* bc.c */
 void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
 void	flush_block(void *addr);
+void	bc_flush(uint32_t blockno, uint32_t n);
+void	bc_prefetch(uint32_t blockno, uint32_t n);
+void	bc_pin(void *va);
+void	bc_unpin(void *va);
 void	bc_init(void);
 
 /* fs.c */
@@ -33,6 +66,7 @@ int	file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
 int	file_create(const char *path, struct File **f);
 int	file_open(const char *path, struct File **f);
 ssize_t	file_read(struct File *f, void *buf, size_t count, off_t offset);
+void	file_prefetch(struct File *f, uint32_t filebno, uint32_t n);
 int	file_write(struct File *f, const void *buf, size_t count, off_t offset);
 int	file_set_size(struct File *f, off_t newsize);
 void	file_flush(struct File *f);
@@ -42,6 +76,7 @@ void	fs_sync(void);
 /* int	map_block(uint32_t); */
 bool	block_is_free(uint32_t blockno);
 int	alloc_block(void);
+int	alloc_block_near(uint32_t goal);
 
 /* test.c */
 void	fs_test(void);
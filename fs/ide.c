@@ -1,7 +1,16 @@
 /*
- * Minimal PIO-based (non-interrupt-driven) IDE driver code.
+ * Interrupt-driven PIO IDE driver code.
  * For information about what all this IDE/ATA magic means,
  * see the materials available on the class references page.
+ *
+ * Requests are queued and run one at a time in submission order.
+ * Instead of spinning on the status register, ide_wait sleeps in
+ * sys_irq_wait and handles the drive's interrupts.  When the kernel
+ * found a PCI bus master IDE controller, the controller moves the
+ * whole request between the disk and the block cache pages itself
+ * (sys_ide_dma sets up its PRD table) and interrupts once at the end.
+ * Otherwise the drive interrupts once per sector and ide_intr copies
+ * the sector with insl/outsl.
  */
 
 #include "fs.h"
@@ -10,10 +19,38 @@
 #define IDE_BSY		0x80
 #define IDE_DRDY	0x40
 #define IDE_DF		0x20
+#define IDE_DRQ		0x08
 #define IDE_ERR		0x01
 
+// Bus master registers, relative to the port sys_ide_dma returns
+#define BMICOM		0	// Command
+#define BMISTA		2	// Status
+#define BMICOM_START	0x01
+#define BMISTA_ERR	0x02
+#define BMISTA_INTR	0x04
+
 static int diskno = 1;
 
+// The bus master's I/O base once sys_ide_dma has worked; set
+// ide_nodma once it says there is no bus master.
+static int ide_bmbase;
+static bool ide_nodma;
+
+// The queued requests; the one at the head is on the drive.
+static struct IdeReq *ide_head, *ide_tail;
+
+// Set if sys_irq_wait is unavailable, so ide_wait polls instead.
+static bool ide_polling;
+
+// Request latencies, submission to completion, since the last
+// ide_report: [0] for reads, [1] for writes.
+static struct {
+	uint32_t n;
+	uint64_t total, max;
+} ide_stats[2];
+
+static void ide_complete(struct IdeReq *req, int result);
+
 static int
 ide_wait_ready(bool check_error)
 {
@@ -57,55 +94,193 @@ ide_set_disk(int d)
 	if (d != 0 && d != 1)
 		panic("bad disk number");
 	diskno = d;
+
+	// Clear nIEN in the device control register so the drive
+	// raises IRQ 14 when it needs attention.
+	outb(0x3F6, 0);
 }
 
-int
-ide_read(uint32_t secno, void *dst, size_t nsecs)
+// Issue the command for the request at the head of the queue, as a
+// DMA transfer if the buffer allows it.  For a PIO write, the drive
+// asks for the first sector right away; later ones are sent from
+// ide_intr.
+static void
+ide_start(void)
 {
+	struct IdeReq *req = ide_head;
+	uint32_t secno = req->ir_secno;
 	int r;
 
-	assert(nsecs <= 256);
-
 	ide_wait_ready(0);
 
-	outb(0x1F2, nsecs);
+	r = -E_NOT_SUPP;
+	if (!ide_nodma)
+		r = sys_ide_dma(req->ir_buf, req->ir_nsecs * SECTSIZE,
+				req->ir_write);
+	if (r == -E_NOT_SUPP)
+		ide_nodma = 1;
+	if ((req->ir_dma = (r > 0)))
+		ide_bmbase = r;
+
+	outb(0x1F2, req->ir_nsecs & 0xFF);	// 0 means 256
 	outb(0x1F3, secno & 0xFF);
 	outb(0x1F4, (secno >> 8) & 0xFF);
 	outb(0x1F5, (secno >> 16) & 0xFF);
 	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x20);	// CMD 0x20 means read sector
 
-	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
-		if ((r = ide_wait_ready(1)) < 0)
-			return r;
-		insl(0x1F0, dst, SECTSIZE/4);
+	if (req->ir_dma) {
+		outb(0x1F7, req->ir_write ? 0xCA : 0xC8);	// write/read DMA
+		outb(ide_bmbase + BMICOM,
+		     inb(ide_bmbase + BMICOM) | BMICOM_START);
+		return;
 	}
 
-	return 0;
+	outb(0x1F7, req->ir_write ? 0x30 : 0x20);	// write/read sectors
+	if (req->ir_write) {
+		if (ide_wait_ready(1) < 0) {
+			ide_complete(req, -1);
+			return;
+		}
+		outsl(0x1F0, req->ir_buf, SECTSIZE/4);
+	}
 }
 
-int
-ide_write(uint32_t secno, const void *src, size_t nsecs)
+// Retire the request at the head of the queue and start the next.
+static void
+ide_complete(struct IdeReq *req, int result)
 {
-	int r;
+	uint64_t t = read_tsc() - req->ir_cycles;
 
-	assert(nsecs <= 256);
+	req->ir_cycles = t;
+	ide_stats[req->ir_write].n++;
+	ide_stats[req->ir_write].total += t;
+	if (t > ide_stats[req->ir_write].max)
+		ide_stats[req->ir_write].max = t;
 
-	ide_wait_ready(0);
+	if (!(ide_head = req->ir_next))
+		ide_tail = NULL;
+	req->ir_result = result;
+	if (ide_head)
+		ide_start();
+}
 
-	outb(0x1F2, nsecs);
-	outb(0x1F3, secno & 0xFF);
-	outb(0x1F4, (secno >> 8) & 0xFF);
-	outb(0x1F5, (secno >> 16) & 0xFF);
-	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x30);	// CMD 0x30 means write sector
+// Do whatever the drive is waiting for.  Reading the status register
+// also acknowledges the interrupt.  A wakeup may be for an earlier
+// command, so trust the status register, not the interrupt: if the
+// drive is still busy, there is nothing to do yet.
+static void
+ide_intr(void)
+{
+	struct IdeReq *req = ide_head;
+	void *buf;
+	int r, s;
 
-	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
-		if ((r = ide_wait_ready(1)) < 0)
-			return r;
-		outsl(0x1F0, src, SECTSIZE/4);
+	r = inb(0x1F7);
+	if (!req || (r & IDE_BSY))
+		return;
+	if (req->ir_dma) {
+		if (!((s = inb(ide_bmbase + BMISTA)) & BMISTA_INTR) &&
+		    !(r & (IDE_DF|IDE_ERR)))
+			return;
+		// Stop the bus master and clear its status.
+		outb(ide_bmbase + BMICOM, 0);
+		outb(ide_bmbase + BMISTA, s | BMISTA_INTR | BMISTA_ERR);
+		req->ir_ndone = req->ir_nsecs;
+		ide_complete(req, (s & BMISTA_ERR) || (r & (IDE_DF|IDE_ERR)) ?
+			     -1 : 0);
+		return;
+	}
+	if (r & (IDE_DF|IDE_ERR)) {
+		ide_complete(req, -1);
+		return;
 	}
 
-	return 0;
+	buf = req->ir_buf + req->ir_ndone * SECTSIZE;
+	if (!req->ir_write) {
+		if (!(r & IDE_DRQ))
+			return;
+		insl(0x1F0, buf, SECTSIZE/4);
+		if (++req->ir_ndone == req->ir_nsecs)
+			ide_complete(req, 0);
+	} else {
+		// The sector sent last is on the disk.
+		if (++req->ir_ndone == req->ir_nsecs)
+			ide_complete(req, 0);
+		else if (r & IDE_DRQ)
+			outsl(0x1F0, buf + SECTSIZE, SECTSIZE/4);
+		else
+			ide_complete(req, -1);
+	}
+}
+
+// Queue 'req' for the drive.  The caller fills in ir_secno, ir_buf,
+// ir_nsecs and ir_write, and must keep 'req' and its buffer around
+// until ide_wait says it is done.
+void
+ide_submit(struct IdeReq *req)
+{
+	assert(req->ir_nsecs > 0 && req->ir_nsecs <= 256);
+
+	req->ir_ndone = 0;
+	req->ir_result = 1;
+	req->ir_cycles = read_tsc();
+	req->ir_next = NULL;
+	if (ide_tail) {
+		ide_tail->ir_next = req;
+		ide_tail = req;
+		return;
+	}
+	ide_head = ide_tail = req;
+	ide_start();
+}
+
+// Sleep until 'req' is done, driving the queue as the drive
+// interrupts.  Returns 0 on success, < 0 on a disk error.
+int
+ide_wait(struct IdeReq *req)
+{
+	while (req->ir_result > 0) {
+		if (!ide_polling && sys_irq_wait(IRQ_IDE) < 0) {
+			cprintf("ide: no interrupts, polling\n");
+			ide_polling = 1;
+		}
+		ide_intr();
+	}
+	return req->ir_result;
+}
+
+int
+ide_read(uint32_t secno, void *dst, size_t nsecs)
+{
+	struct IdeReq req = { secno, dst, nsecs, 0 };
+
+	ide_submit(&req);
+	return ide_wait(&req);
+}
+
+int
+ide_write(uint32_t secno, const void *src, size_t nsecs)
+{
+	struct IdeReq req = { secno, (void *) src, nsecs, 1 };
+
+	ide_submit(&req);
+	return ide_wait(&req);
+}
+
+// Print the request latencies since the last report, and start over.
+void
+ide_report(void)
+{
+	static const char *what[2] = { "reads", "writes" };
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (ide_stats[i].n == 0)
+			continue;
+		cprintf("ide: %u %s, latency avg %llu max %llu cycles\n",
+			ide_stats[i].n, what[i],
+			ide_stats[i].total / ide_stats[i].n, ide_stats[i].max);
+	}
+	memset(ide_stats, 0, sizeof(ide_stats));
 }
 
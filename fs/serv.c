@@ -11,6 +11,10 @@
 
 #define debug 0
 
+// Where serve_map lines up the blocks it sends, and how many fit.
+#define MAPWIN		UTEMP
+#define MAPWIN_NPAGES	((PFTEMP - UTEMP) / PGSIZE)
+
 // The file system server maintains three structures
 // for each open file.
 //
@@ -36,8 +40,15 @@ struct OpenFile {
 	struct File *o_file;	// mapped descriptor for open file
 	int o_mode;		// open mode
 	struct Fd *o_fd;	// Fd page
+	uint32_t o_ra_next;	// Block after the last one read
+	uint32_t o_ra_end;	// Block after the last one read ahead
+	uint32_t o_ra_window;	// Blocks to read ahead of a sequential read
 };
 
+// Read-ahead window bounds, in blocks
+#define RA_MIN		4
+#define RA_MAX		32
+
 // Max number of open files in the file system at once
 #define MAXOPEN		1024
 #define FILEVA		0xD0000000
@@ -82,6 +93,8 @@ openfile_alloc(struct OpenFile **o)
       opentab[i].o_fileid += MAXOPEN; // what's that mean?
       *o = &opentab[i];
       memset(opentab[i].o_fd, 0, PGSIZE); //fd page is cleared to zero
+      opentab[i].o_ra_next = opentab[i].o_ra_end = 0;
+      opentab[i].o_ra_window = 0;
       return (*o)->o_fileid;
     }
   }
@@ -198,6 +211,31 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *req)
 	return file_set_size(o->o_file, req->req_size);
 }
 
+// Prefetch the blocks that a read of 'n' bytes at 'offset' in o is
+// about to touch, plus, while o is being read sequentially, a window
+// of blocks beyond them that doubles with each sequential read up to
+// RA_MAX.  A read anywhere else closes the window again.  The window
+// is refilled once the reader is half way through it, so that the
+// disk sees a few large reads rather than one per block.
+static void
+readahead(struct OpenFile *o, off_t offset, size_t n)
+{
+	uint32_t first = offset / BLKSIZE;
+	uint32_t end = (offset + n + BLKSIZE - 1) / BLKSIZE;
+
+	if (first == o->o_ra_next || first + 1 == o->o_ra_next)
+		o->o_ra_window = MIN(MAX(o->o_ra_window * 2, RA_MIN), RA_MAX);
+	else {
+		o->o_ra_window = 0;
+		o->o_ra_end = 0;
+	}
+	o->o_ra_next = end;
+	if (end + o->o_ra_window / 2 <= o->o_ra_end)
+		return;
+	file_prefetch(o->o_file, first, end - first + o->o_ra_window);
+	o->o_ra_end = end + o->o_ra_window;
+}
+
 // Read at most ipc->read.req_n bytes from the current seek position
 // in ipc->read.req_fileid.  Return the bytes read from the file to
 // the caller in ipc->readRet, then update the seek position.  Returns
@@ -227,7 +265,7 @@ serve_read(envid_t envid, union Fsipc *ipc)
     
     n = (req->req_n > PGSIZE) ? PGSIZE : req->req_n;
     // from fileid to File
-    
+    readahead(o, o->o_fd->fd_offset, n);
     r = file_read(o->o_file, ret->ret_buf, n, o->o_fd->fd_offset);
     if (r >= 0) o->o_fd->fd_offset += r;
     
@@ -264,6 +302,54 @@ serve_write(envid_t envid, struct Fsreq_write *req)
     return r;  
 }
 
+// Share up to req->req_npages blocks of req->req_fileid, starting at
+// req->req_offset (which must be block aligned and inside the file),
+// with the caller.  The blocks are mapped one after another at MAPWIN,
+// which is stored in *pg_store along with the number of pages in
+// *npages_store and read-only permissions in *perm_store, for serve
+// to send in a single IPC.  Returns the number of blocks.
+// This lets spawn map a whole program without copying it, so that
+// every env running the program shares the same pages.
+int
+serve_map(envid_t envid, struct Fsreq_map *req,
+	  void **pg_store, size_t *npages_store, int *perm_store)
+{
+	struct OpenFile *o;
+	char *blk;
+	size_t i, n;
+	int r;
+
+	if (debug)
+		cprintf("serve_map %08x %08x %08x %d\n", envid, req->req_fileid,
+			req->req_offset, req->req_npages);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if (req->req_offset < 0 || req->req_offset % BLKSIZE != 0 ||
+	    req->req_offset >= o->o_file->f_size || req->req_npages == 0)
+		return -E_INVAL;
+	n = MIN(req->req_npages, MAPWIN_NPAGES);
+	n = MIN(n, ROUNDUP(o->o_file->f_size - req->req_offset, BLKSIZE) / BLKSIZE);
+	readahead(o, req->req_offset, n * BLKSIZE);
+
+	for (i = 0; i < n; i++) {
+		if ((r = file_get_block(o->o_file, req->req_offset / BLKSIZE + i, &blk)) < 0)
+			goto fail;
+		// Fault the block in, so that there is a page to send.
+		*(volatile char *) blk;
+		if ((r = sys_page_map(0, blk, 0, MAPWIN + i * PGSIZE, PTE_P | PTE_U)) < 0)
+			goto fail;
+	}
+	*pg_store = MAPWIN;
+	*npages_store = n;
+	*perm_store = PTE_P | PTE_U;
+	return n;
+
+fail:
+	sys_page_unmap_range(0, MAPWIN, i * PGSIZE);
+	return r;
+}
+
 // Stat ipc->stat.req_fileid.  Return the file's struct Stat to the
 // caller in ipc->statRet.
 int
@@ -323,18 +409,20 @@ serve_remove(envid_t envid, struct Fsreq_remove *req)
 	return file_remove(path);
 }
 
-// Sync the file system.
+// Sync the file system, and report how long the disk took to serve
+// the requests since the last sync.
 int
 serve_sync(envid_t envid, union Fsipc *req)
 {
 	fs_sync();
+	ide_report();
 	return 0;
 }
 
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
 
 fshandler handlers[] = {
-	// Open is handled specially because it passes pages
+	// Open and map are handled specially because they pass pages
 	/* [FSREQ_OPEN] =	(fshandler)serve_open, */
 	[FSREQ_SET_SIZE] =	(fshandler)serve_set_size,
 	[FSREQ_READ] =		serve_read,
@@ -352,6 +440,7 @@ serve(void)
 	uint32_t req, whom;
 	int perm, r;
 	void *pg;
+	size_t npages;
 
 	while (1) {
 		perm = 0;
@@ -368,15 +457,21 @@ serve(void)
 		}
 
 		pg = NULL;
+		npages = 1;
 		if (req == FSREQ_OPEN) {
 			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
+		} else if (req == FSREQ_MAP) {
+			r = serve_map(whom, (struct Fsreq_map*)fsreq, &pg, &npages, &perm);
 		} else if (req < NHANDLERS && handlers[req]) {
 			r = handlers[req](whom, fsreq);
 		} else {
 			cprintf("Invalid request code %d from %08x\n", whom, req);
 			r = -E_INVAL;
 		}
-		ipc_send(whom, r, pg, perm); // share pg and perm in open with caller
+		// share pg and perm in open (npages of them in map) with caller
+		ipc_send_pages(whom, r, pg, npages, perm);
+		if (pg == MAPWIN)
+			sys_page_unmap_range(0, MAPWIN, npages * PGSIZE);
 		sys_page_unmap(0, fsreq);
 	}
 }
@@ -6,6 +6,78 @@
 
 static char *msg = "This is the NEW message of the day!\n\n";
 
+static uint32_t
+count_free(void)
+{
+	uint32_t b, n = 0;
+
+	for (b = 0; b < super->s_nblocks; b++)
+		n += block_is_free(b);
+	return n;
+}
+
+static void
+check_tag(struct File *f, uint32_t filebno, uint32_t tag)
+{
+	uint32_t v;
+	int r;
+
+	if ((r = file_read(f, &v, sizeof(v), filebno * BLKSIZE)) != sizeof(v))
+		panic("file_read block %d: %e", filebno, r);
+	if (v != tag)
+		panic("block %d holds %08x, not %08x", filebno, v, tag);
+}
+
+// Grow two files a block at a time, interleaved, so that neither can
+// extend its last extent: the first runs out of extents and continues
+// in the double-indirect map, then gets a block past a hole.  Check
+// the data, then truncate it back across the extent/map boundary.
+static void
+check_extents(void)
+{
+	struct File *a, *b;
+	uint32_t nfree, i, n = NEXTENT + 8, hole = NEXTENT + 40;
+	int r;
+
+	if ((r = file_create("/extents-a", &a)) < 0 ||
+	    (r = file_create("/extents-b", &b)) < 0)
+		panic("file_create: %e", r);
+	nfree = count_free();
+	for (i = 0; i < n; i++) {
+		if ((r = file_write(a, &i, sizeof(i), i * BLKSIZE)) < 0 ||
+		    (r = file_write(b, &i, sizeof(i), i * BLKSIZE)) < 0)
+			panic("file_write: %e", r);
+	}
+	i = ~hole;
+	if ((r = file_write(a, &i, sizeof(i), hole * BLKSIZE)) < 0)
+		panic("file_write past hole: %e", r);
+	assert(a->f_extents[NEXTENT - 1].ex_nblocks != 0);
+	assert(a->f_dindirect != 0);
+	for (i = 0; i < n; i++)
+		check_tag(a, i, i);
+	check_tag(a, hole, ~hole);
+
+	if ((r = file_set_size(a, (NEXTENT + 2) * BLKSIZE)) < 0)
+		panic("file_set_size: %e", r);
+	assert(a->f_dindirect != 0);
+	for (i = 0; i < NEXTENT + 2; i++)
+		check_tag(a, i, i);
+	if ((r = file_set_size(a, (NEXTENT - 2) * BLKSIZE)) < 0)
+		panic("file_set_size 2: %e", r);
+	assert(a->f_dindirect == 0);
+	assert(a->f_extents[NEXTENT - 2].ex_nblocks == 0);
+	for (i = 0; i < NEXTENT - 2; i++)
+		check_tag(a, i, i);
+
+	if ((r = file_set_size(a, 0)) < 0 || (r = file_set_size(b, 0)) < 0)
+		panic("file_set_size 3: %e", r);
+	if (count_free() != nfree)
+		panic("%d blocks leaked", nfree - count_free());
+	if ((r = file_remove("/extents-a")) < 0 ||
+	    (r = file_remove("/extents-b")) < 0)
+		panic("file_remove: %e", r);
+}
+
 void
 fs_test(void)
 {
@@ -50,7 +122,7 @@ fs_test(void)
 
 	if ((r = file_set_size(f, 0)) < 0)
 		panic("file_set_size: %e", r);
-	assert(f->f_direct[0] == 0);
+	assert(f->f_extents[0].ex_nblocks == 0);
 	assert(!(vpt[PGNUM(f)] & PTE_D));
 	cprintf("file_truncate is good\n");
 
@@ -65,4 +137,7 @@ fs_test(void)
 	assert(!(vpt[PGNUM(blk)] & PTE_D));
 	assert(!(vpt[PGNUM(f)] & PTE_D));
 	cprintf("file rewrite is good\n");
+
+	check_extents();
+	cprintf("block map is good\n");
 }
@@ -6,6 +6,8 @@
 #include <inc/types.h>
 #include <inc/trap.h>
 #include <inc/memlayout.h>
+#include <inc/syscall.h>
+#include <inc/queue.h>
 
 typedef int32_t envid_t;
 
@@ -25,7 +27,11 @@ typedef int32_t envid_t;
 // envid_ts less than 0 signify errors.  The envid_t == 0 is special, and
 // stands for the current environment.
 
+// LOG2NENV may be raised at build time (e.g. DEFS=-DLOG2NENV=12), as
+// long as the envs[] array still fits below USERVICES.
+#ifndef LOG2NENV
 #define LOG2NENV		10
+#endif
 #define NENV			(1 << LOG2NENV)
 #define ENVX(envid)		((envid) & (NENV - 1))
 
@@ -44,30 +50,121 @@ enum EnvType {
 	ENV_TYPE_IDLE,
 	ENV_TYPE_FS,		// File system server
 	ENV_TYPE_NS,		// Network server
+	ENV_NTYPES
 };
 
+// Scheduling classes (env_sched_class).
+// Runnable ENV_SCHED_SYSTEM envs always run before ENV_SCHED_FAIR ones
+// and are picked round-robin among themselves.  ENV_SCHED_FAIR envs
+// share the remaining CPU time in proportion to their env_weight.
+enum {
+	ENV_SCHED_FAIR = 0,
+	ENV_SCHED_SYSTEM,
+	ENV_SCHED_NCLASS
+};
+
+// Snapshot states (env_snapshot), see sys_env_snapshot.
+enum {
+	ENV_SNAP_NONE = 0,
+	ENV_SNAP_PENDING,	// Freeze once libmain has initialized the env
+	ENV_SNAP_FROZEN		// Never runs again; sys_env_clone copies it
+};
+
+#define ENV_WEIGHT_MIN		1
+#define ENV_WEIGHT_DEFAULT	16
+#define ENV_WEIGHT_MAX		256
+
+// Per-environment resource accounting, kept by the kernel and readable
+// by user space through the read-only envs[] mapping at UENVS.
+// Cleared when the Env is allocated.
+struct EnvStats {
+	uint64_t es_cycles;			// TSC cycles run in user mode
+	uint32_t es_syscalls[NSYSCALLS];	// System calls, by number
+	uint32_t es_pgfaults;			// User page faults
+	uint32_t es_cowfaults;			// ... of which COW breaks
+	uint32_t es_ipc_sent;			// IPC messages delivered
+	uint32_t es_ipc_recv;			// IPC messages received
+	uint32_t es_npages;			// Pages mapped below UTOP
+};
+
+// x87/SSE register image in the layout fxsave stores.
+struct FpuState {
+	uint16_t fx_fcw;		// x87 control word
+	uint16_t fx_fsw;		// x87 status word
+	uint8_t fx_ftw;			// Abridged tag word
+	uint8_t fx_pad0;
+	uint16_t fx_fop;
+	uint32_t fx_fip, fx_fcs, fx_fdp, fx_fds;
+	uint32_t fx_mxcsr;		// SSE control/status
+	uint32_t fx_mxcsr_mask;
+	uint8_t fx_regs[480];		// ST0-7, XMM0-7, reserved
+} __attribute__((aligned(16)));
+
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	struct Env *env_link;		// Next free Env
+	LIST_ENTRY(Env) env_live_link;	// Allocated-env list link
 	envid_t env_id;			// Unique environment identifier
 	envid_t env_parent_id;		// env_id of this env's parent
 	enum EnvType env_type;		// Indicates special system environments
 	unsigned env_status;		// Status of the environment
 	uint32_t env_runs;		// Number of times environment has run
 	int env_cpunum;			// The CPU that the env is running on
+	int env_snapshot;		// ENV_SNAP_*
+
+	// Scheduling
+	int env_sched_class;		// ENV_SCHED_FAIR or ENV_SCHED_SYSTEM
+	uint32_t env_weight;		// CPU share within the fair class
+	uint64_t env_vruntime;		// Run time scaled by 1/env_weight
+	uint64_t env_run_start;		// TSC when last dispatched
 
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
 
 	// Exception handling
 	void *env_pgfault_upcall;	// Page fault upcall entry point
+	uintptr_t env_fill_start;	// Fill region, see sys_env_set_fault_fill
+	uintptr_t env_fill_end;
+	uintptr_t env_fill_va;		// Alias of the last page filled in
 
 	// Lab 4 IPC
 	bool env_ipc_recving;		// Env is blocked receiving
 	void *env_ipc_dstva;		// VA at which to map received page
+	size_t env_ipc_dstnpages;	// Pages we can take at env_ipc_dstva
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+	size_t env_ipc_npages;		// Number of pages received
+
+	// Console input
+	bool env_cons_waiting;		// Env is blocked in sys_cgetc_wait
+
+	// Device interrupts
+	bool env_irq_waiting;		// Env is blocked in sys_irq_wait
+
+	// Resource accounting
+	struct EnvStats env_stats;
+
+	struct FpuState env_fpu;	// Saved x87/SSE registers
+};
+
+// Registry of well-known service environments, maintained by the
+// kernel and mapped read-only at USERVICES so that clients can find
+// a server without scanning envs[].  The kernel fills in reg_bytype
+// for the special env types it creates; any env can add itself to
+// reg_names with sys_env_register.  Entries are cleared when the
+// registered env is freed.
+#define NSERVICE		32
+#define SERVICE_NAMELEN		16
+
+struct EnvService {
+	char sv_name[SERVICE_NAMELEN];	// NUL-terminated; "" if unused
+	envid_t sv_envid;
+};
+
+struct EnvRegistry {
+	envid_t reg_bytype[ENV_NTYPES];	// Env of each special type, or 0
+	struct EnvService reg_names[NSERVICE];
 };
 
 #endif // !JOS_INC_ENV_H
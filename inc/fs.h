@@ -19,26 +19,39 @@
 // Maximum size of a complete pathname, including null
 #define MAXPATHLEN	1024
 
-// Number of block pointers in a File descriptor
-#define NDIRECT		10
-// Number of direct block pointers in an indirect block
+// A file's blocks are mapped by extents, runs of consecutive disk
+// blocks.  The NEXTENT extents in the File map file blocks 0, 1, ...
+// in order, without holes; an extent with ex_nblocks == 0 ends the
+// list.  Blocks past the extents (once they are used up, or for a
+// file with holes) are mapped one by one through a double-indirect
+// block: f_dindirect holds the numbers of up to NINDIRECT indirect
+// blocks, each holding NINDIRECT disk block numbers.
+#define NEXTENT		14
+// Number of block numbers in an indirect block
 #define NINDIRECT	(BLKSIZE / 4)
 
-#define MAXFILESIZE	((NDIRECT + NINDIRECT) * BLKSIZE)
+// Largest file size, in bytes, that off_t can describe in whole blocks
+#define MAXFILESIZE	0x7FFFF000
+
+struct Extent {
+	uint32_t ex_start;		// first disk block
+	uint32_t ex_nblocks;		// number of blocks; 0 if unused
+};
 
 struct File {
 	char f_name[MAXNAMELEN];	// filename
 	off_t f_size;			// file size in bytes
 	uint32_t f_type;		// file type
 
-	// Block pointers.
-	// A block is allocated iff its value is != 0.
-	uint32_t f_direct[NDIRECT];	// direct blocks (data is block number)
-	uint32_t f_indirect;		// indirect block (data is block number)
+	// Block map.
+	// A block is allocated iff it is in an extent or its map entry
+	// is != 0.
+	struct Extent f_extents[NEXTENT];
+	uint32_t f_dindirect;		// double-indirect block (block number)
 
 	// Pad out to 256 bytes; must do arithmetic in case we're compiling
 	// fsformat on a 64-bit machine.
-	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4];
+	uint8_t f_pad[256 - MAXNAMELEN - 8 - 8*NEXTENT - 4];
 } __attribute__((packed));	// required only on some 64-bit machines
 
 // An inode block contains exactly BLKFILES 'struct File's
@@ -51,7 +64,7 @@ struct File {
 
 // File system super-block (both in-memory and on-disk)
 
-#define FS_MAGIC	0x4A0530AE	// related vaguely to 'J\0S!'
+#define FS_MAGIC	0x4A0530AF	// related vaguely to 'J\0S!', + 1 for extents
 
 struct Super {
 	uint32_t s_magic;		// Magic number: FS_MAGIC
@@ -70,7 +83,9 @@ enum {
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Map returns the requested file blocks, read-only, as reply pages
+	FSREQ_MAP
 };
 
 union Fsipc {
@@ -108,6 +123,11 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_map {
+		int req_fileid;
+		off_t req_offset;
+		size_t req_npages;
+	} map;
 
 	// Ensure Fsipc is one page
 	char _pad[PGSIZE];
@@ -32,6 +32,7 @@ void	umain(int argc, char **argv);
 extern const char *binaryname;
 extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
+extern const volatile struct EnvRegistry services;
 extern const volatile struct Page pages[];
 
 // exit.c
@@ -46,6 +47,7 @@ char*	readline(const char *buf);
 // syscall.c
 void	sys_cputs(const char *string, size_t len);
 int	sys_cgetc(void);
+int	sys_cgetc_wait(void);
 envid_t	sys_getenvid(void);
 int	sys_env_destroy(envid_t);
 void	sys_yield(void);
@@ -57,10 +59,26 @@ int	sys_page_alloc(envid_t env, void *pg, int perm);
 int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
+int	sys_page_alloc_range(envid_t env, void *va, size_t len, int perm);
+int	sys_page_unmap_range(envid_t env, void *va, size_t len);
+int	sys_page_protect(envid_t env, void *va, size_t len, int perm);
+int	sys_page_reserve(envid_t env, void *va, size_t len, int perm);
+int	sys_env_set_fault_fill(envid_t env, void *va, size_t len, void *fillva);
+int	sys_klog_read(char *buf, size_t len, uint32_t *pos);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	sys_ipc_try_send_pages(envid_t to_env, uint32_t value, void *pg,
+			       size_t npages, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_recv_pages(void *rcv_pg, size_t npages);
+int	sys_env_load(envid_t env, const void *binary, size_t size);
+int	sys_env_snapshot(envid_t env);
+envid_t	sys_env_clone(envid_t snap);
+int	sys_irq_wait(int irq);
+int	sys_ide_dma(void *va, size_t len, bool todisk);
 unsigned int sys_time_msec(void);
 int sys_pci_send_pkt(envid_t envid, void *pktva, size_t len);
+int	sys_env_set_priority(envid_t envid, int sched_class, int weight);
+int	sys_env_register(const char *name);
 
 
 // This must be inlined.  Exercise for reader: why?
@@ -78,11 +96,15 @@ sys_exofork(void)
 
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
+void	ipc_send_pages(envid_t to_env, uint32_t value, void *pg,
+		       size_t npages, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_pages(envid_t *from_env_store, void *pg, size_t *npages,
+		       int *perm_store);
 envid_t	ipc_find_env(enum EnvType type);
+envid_t	ipc_find_service(const char *name);
 
 // fork.c
-#define	PTE_SHARE	0x400
 envid_t	fork(void);
 envid_t	sfork(void);	// Challenge!
 
@@ -102,6 +124,7 @@ int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	fmap(int fd, off_t offset, size_t npages, void *dstva);
 
 // pageref.c
 int	pageref(void *addr);
@@ -128,6 +151,8 @@ int     nsipc_socket(int domain, int type, int protocol);
 // spawn.c
 envid_t	spawn(const char *program, const char **argv);
 envid_t	spawnl(const char *program, const char *arg0, ...);
+envid_t	spawn_snapshot(const char *program, const char **argv);
+envid_t	spawn_clone(envid_t snap);
 
 
 /* File open modes */
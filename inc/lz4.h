@@ -0,0 +1,29 @@
+#ifndef JOS_INC_LZ4_H
+#define JOS_INC_LZ4_H
+
+#include <inc/types.h>
+
+// LZ4 block compression.
+// The program images embedded in the kernel are stored as an Lz4Hdr
+// followed by one LZ4 block (see kern/lz4pack.c), and env_create
+// expands them as it loads them.
+
+#define LZ4_MAGIC	0x347A4C7FU	/* "\x7FLz4" in little endian */
+
+// Matches are at least this long and reach back at most 64K.
+#define LZ4_MINMATCH	4
+#define LZ4_WINDOW	65535
+
+// The last match must start at least 12 bytes before the end of the
+// block, and the last 5 bytes are always literals.
+#define LZ4_MFLIMIT	12
+#define LZ4_LASTLITERALS 5
+
+struct Lz4Hdr {
+	uint32_t lz_magic;	// must equal LZ4_MAGIC
+	uint32_t lz_size;	// Size of the data once expanded
+};
+
+int lz4_decompress(const void *src, size_t srclen, void *dst, size_t dstlen);
+
+#endif	// !JOS_INC_LZ4_H
@@ -52,7 +52,9 @@
  *    UVPT      ---->  +------------------------------+ 0xef400000
  *                     |          RO PAGES            | R-/R-  PTSIZE
  *    UPAGES    ---->  +------------------------------+ 0xef000000
- *                     |           RO ENVS            | R-/R-  PTSIZE
+ *                     |  RO SERVICES (last page)     | R-/R-  PGSIZE
+ *    USERVICES ---->  +------------------------------+ 0xeefff000
+ *                     |           RO ENVS            | R-/R-  PTSIZE-PGSIZE
  * UTOP,UENVS ------>  +------------------------------+ 0xeec00000
  * UXSTACKTOP -/       |     User Exception Stack     | RW/RW  PGSIZE
  *                     +------------------------------+ 0xeebff000
@@ -116,6 +118,8 @@
 #define UPAGES		(UVPT - PTSIZE)
 // Read-only copies of the global env structures
 #define UENVS		(UPAGES - PTSIZE)
+// Read-only service registry (struct EnvRegistry), after the envs
+#define USERVICES	(UPAGES - PGSIZE)
 
 /*
  * Top of user VM. User can manipulate VA from UTOP-1 and down!
@@ -143,6 +147,11 @@
 // Physical address of startup code for non-boot CPUs (APs)
 #define MPENTRY_PADDR	0x7000
 
+// Physical address where the boot loader leaves two uint64_t TSC
+// readings: when it started and when it finished loading the kernel.
+// Just past the boot sector, in the page reserved for MPENTRY_PADDR.
+#define BOOTTSC_PADDR	0x7E00
+
 // The physical address where IO memory starts
 #define IOMEM_PADDR	0xfe000000
 // The virtual address we map IO memory to
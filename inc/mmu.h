@@ -74,6 +74,15 @@
 // hardware, so user processes are allowed to set them arbitrarily.
 #define PTE_AVAIL	0xE00	// Available for software use
 
+// A PTE with PTE_LAZY but not PTE_P reserves a demand-zero page: the
+// kernel maps a fresh zeroed page, with the PTE's other permission
+// bits, the first time the page is touched.  See sys_page_reserve.
+#define PTE_LAZY	0x200
+
+// PTE_SHARE pages are shared, not copied, when an address space is
+// duplicated (by spawn, fork or sys_env_clone).
+#define PTE_SHARE	0x400
+
 // Flags in PTE_SYSCALL may be used in system calls.  (Others may not.)
 #define PTE_SYSCALL	(PTE_AVAIL | PTE_P | PTE_W | PTE_U)
 
@@ -93,6 +102,8 @@
 #define CR0_CD		0x40000000	// Cache Disable
 #define CR0_PG		0x80000000	// Paging
 
+#define CR4_OSXMMEXCPT	0x00000400	// Unmasked SSE exceptions raise #XM
+#define CR4_OSFXSR	0x00000200	// OS supports FXSAVE/FXRSTOR and SSE
 #define CR4_PCE		0x00000100	// Performance counter enable
 #define CR4_MCE		0x00000040	// Machine Check Enable
 #define CR4_PSE		0x00000010	// Page Size Extensions
@@ -19,6 +19,20 @@ enum {
 	SYS_ipc_recv,
 	SYS_time_msec,
     SYS_pci_send_pkt,
+	SYS_env_set_priority,
+	SYS_env_register,
+	SYS_page_alloc_range,
+	SYS_page_unmap_range,
+	SYS_page_protect,
+	SYS_page_reserve,
+	SYS_env_set_fault_fill,
+	SYS_klog_read,
+	SYS_cgetc_wait,
+	SYS_env_load,
+	SYS_env_snapshot,
+	SYS_env_clone,
+	SYS_irq_wait,
+	SYS_ide_dma,
 	NSYSCALLS
 };
 
@@ -255,6 +255,27 @@ read_esp(void)
         return esp;
 }
 
+// Feature bits in %edx of CPUID leaf 1
+#define CPUID_FEAT_FXSR	(1 << 24)	// FXSAVE/FXRSTOR
+#define CPUID_FEAT_SSE2	(1 << 26)
+
+// Bracket inline asm that uses xmm0-3 so that it puts them back the
+// way it found them.  JOS code is built without SSE, so such asm blocks
+// are the only users of the registers, and a user page fault handler
+// that copies memory must not disturb a copy it interrupted.
+#define XMM_SAVE						\
+	"subl $64, %%esp\n\t"					\
+	"movdqu %%xmm0, (%%esp)\n\t"				\
+	"movdqu %%xmm1, 16(%%esp)\n\t"				\
+	"movdqu %%xmm2, 32(%%esp)\n\t"				\
+	"movdqu %%xmm3, 48(%%esp)\n"
+#define XMM_RESTORE						\
+	"\n\tmovdqu (%%esp), %%xmm0\n\t"			\
+	"movdqu 16(%%esp), %%xmm1\n\t"				\
+	"movdqu 32(%%esp), %%xmm2\n\t"				\
+	"movdqu 48(%%esp), %%xmm3\n\t"				\
+	"addl $64, %%esp"
+
 static __inline void
 cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
 {
@@ -5,12 +5,16 @@
 #include <inc/kbdreg.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/trap.h>
+#include <inc/error.h>
 
 #include <kern/console.h>
 #include <kern/picirq.h>
+#include <kern/spinlock.h>
+#include <kern/env.h>
 
 static void cons_intr(int (*proc)(void));
-static void cons_putc(int c);
+static void cons_drain(void);
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
 static void
@@ -32,8 +36,12 @@ delay(void)
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_TXRDY	0x02	//   Enable transmit buffer empty interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE	0x01	//   Enable FIFOs
+#define   COM_FCR_CLEAR	0x06	//   Clear both FIFOs
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -47,6 +55,8 @@ delay(void)
 #define   COM_LSR_TSRE	0x40	//   Transmitter off
 
 static bool serial_exists;
+static int serial_txfifo;	// Bytes we can write once TXRDY is set
+static uint8_t serial_ier;
 
 static int
 serial_proc_data(void)
@@ -61,6 +71,7 @@ serial_intr(void)
 {
 	if (serial_exists)
 		cons_intr(serial_proc_data);
+	cons_drain();
 }
 
 static void
@@ -76,11 +87,31 @@ serial_putc(int c)
 	outb(COM1 + COM_TX, c);
 }
 
+// Write whatever the transmitter can take without waiting from
+// [*pos, end) in buf, and ask for an interrupt if that was not all.
+static void
+serial_write(const char *buf, uint32_t *pos, uint32_t end, uint32_t mask)
+{
+	uint8_t ier;
+	int n;
+
+	if (inb(COM1 + COM_LSR) & COM_LSR_TXRDY)
+		for (n = 0; n < serial_txfifo && *pos != end; n++)
+			outb(COM1 + COM_TX, buf[(*pos)++ & mask]);
+
+	ier = COM_IER_RDI | (*pos != end ? COM_IER_TXRDY : 0);
+	if (ier != serial_ier) {
+		serial_ier = ier;
+		outb(COM1 + COM_IER, ier);
+	}
+}
+
 static void
 serial_init(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	// Turn on the FIFOs, with a receive interrupt for every byte.
+	// An 8250 has no FIFO and ignores this.
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_CLEAR);
 	
 	// Set speed; requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
@@ -93,14 +124,18 @@ serial_init(void)
 	// No modem controls
 	outb(COM1+COM_MCR, 0);
 	// Enable rcv interrupts
-	outb(COM1+COM_IER, COM_IER_RDI);
+	serial_ier = COM_IER_RDI;
+	outb(COM1+COM_IER, serial_ier);
 
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
 	serial_exists = (inb(COM1+COM_LSR) != 0xFF);
-	(void) inb(COM1+COM_IIR);
+	serial_txfifo = (inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO ? 16 : 1;
 	(void) inb(COM1+COM_RX);
 
+	// Transmit-empty interrupts drain the kernel log
+	if (serial_exists)
+		irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_SERIAL));
 }
 
 
@@ -121,6 +156,15 @@ lpt_putc(int c)
 	outb(0x378+2, 0x08);
 }
 
+// Write bytes from [*pos, end) in buf for as long as the printer is
+// not busy.
+static void
+lpt_write(const char *buf, uint32_t *pos, uint32_t end, uint32_t mask)
+{
+	while (*pos != end && (inb(0x378+1) & 0x80))
+		lpt_putc(buf[(*pos)++ & mask]);
+}
+
 
 
 
@@ -181,11 +225,11 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
 		break;
 	default:
 		crt_buf[crt_pos++] = c;		/* write the character */
@@ -391,6 +435,49 @@ static struct {
 	uint32_t wpos;
 } cons;
 
+// Envs blocked in sys_cgetc_wait, oldest first.  Like the input
+// buffer, this is only used with the big kernel lock held: keyboard
+// and serial interrupts only arrive from user mode.
+#define CONS_NWAIT	8
+
+static struct {
+	envid_t envs[CONS_NWAIT];
+	uint32_t head;		// Next env to wake
+	uint32_t tail;		// Total envs ever queued
+} cons_waiters;
+
+static int
+cons_take(void)
+{
+	int c;
+
+	if (cons.rpos == cons.wpos)
+		return 0;
+	c = cons.buf[cons.rpos++];
+	if (cons.rpos == CONSBUFSIZE)
+		cons.rpos = 0;
+	return c;
+}
+
+// Hand buffered input to blocked readers, one character each.  The
+// character becomes the return value of the reader's sys_cgetc_wait.
+static void
+cons_wakeup(void)
+{
+	struct Env *e;
+	envid_t envid;
+
+	while (cons_waiters.head != cons_waiters.tail && cons.rpos != cons.wpos) {
+		envid = cons_waiters.envs[cons_waiters.head++ % CONS_NWAIT];
+		if (envid2env(envid, &e, 0) < 0 || !e->env_cons_waiting ||
+		    e->env_status != ENV_NOT_RUNNABLE)
+			continue;
+		e->env_cons_waiting = 0;
+		e->env_tf.tf_regs.reg_eax = cons_take();
+		e->env_status = ENV_RUNNABLE;
+	}
+}
+
 // called by device interrupt routines to feed input characters
 // into the circular console input buffer.
 static void
@@ -405,14 +492,13 @@ cons_intr(int (*proc)(void))
 		if (cons.wpos == CONSBUFSIZE)
 			cons.wpos = 0;
 	}
+	cons_wakeup();
 }
 
 // return the next input character from the console, or 0 if none waiting
 int
 cons_getc(void)
 {
-	int c;
-
 	// poll for any pending input characters,
 	// so that this function works even when interrupts are disabled
 	// (e.g., when called from the kernel monitor).
@@ -420,28 +506,124 @@ cons_getc(void)
 	kbd_intr();
 
 	// grab the next character from the input buffer.
-	if (cons.rpos != cons.wpos) {
-		c = cons.buf[cons.rpos++];
-		if (cons.rpos == CONSBUFSIZE)
-			cons.rpos = 0;
-		return c;
-	}
+	return cons_take();
+}
+
+// Queue 'e' to be handed the next input character by cons_wakeup.
+// The caller blocks it.  Returns -E_NO_MEM if too many envs are
+// already waiting.
+int
+cons_wait(struct Env *e)
+{
+	if (cons_waiters.tail - cons_waiters.head == CONS_NWAIT)
+		return -E_NO_MEM;
+	cons_waiters.envs[cons_waiters.tail++ % CONS_NWAIT] = e->env_id;
+	e->env_cons_waiting = 1;
 	return 0;
 }
 
-// output a character to the console
+/***** Kernel log *****/
+// All console output goes into the kernel log ring first.  The CGA
+// display is updated right away, but the serial and parallel ports
+// are slow, so they drain the ring asynchronously: each takes as much
+// as it can without waiting whenever output is added, and the rest
+// goes from the serial transmit interrupt and the timer tick.  A
+// writer only waits for a port that has fallen a whole ring behind.
+
+static struct {
+	char buf[KLOG_SIZE];
+	uint32_t wpos;		// Total bytes ever logged
+	uint32_t serial_pos;	// Next byte for the serial port
+	uint32_t lpt_pos;	// Next byte for the parallel port
+} klog;
+
+// Protects klog and the output devices.  Console output does not need
+// the big kernel lock.
+static struct spinlock cons_lock;
+
+static void
+klog_putc(int c)
+{
+	while (klog.wpos - klog.serial_pos >= KLOG_SIZE) {
+		if (serial_exists)
+			serial_putc(klog.buf[klog.serial_pos & (KLOG_SIZE - 1)]);
+		klog.serial_pos++;
+	}
+	while (klog.wpos - klog.lpt_pos >= KLOG_SIZE)
+		lpt_putc(klog.buf[klog.lpt_pos++ & (KLOG_SIZE - 1)]);
+	klog.buf[klog.wpos++ & (KLOG_SIZE - 1)] = c;
+}
+
+static void
+cons_drain_locked(void)
+{
+	if (serial_exists)
+		serial_write(klog.buf, &klog.serial_pos, klog.wpos, KLOG_SIZE - 1);
+	else
+		klog.serial_pos = klog.wpos;
+	lpt_write(klog.buf, &klog.lpt_pos, klog.wpos, KLOG_SIZE - 1);
+}
+
+// Push pending log output to the ports, without waiting for them.
 static void
-cons_putc(int c)
+cons_drain(void)
 {
-	serial_putc(c);
-	lpt_putc(c);
-	cga_putc(c);
+	spin_lock(&cons_lock);
+	cons_drain_locked();
+	spin_unlock(&cons_lock);
+}
+
+// Called on every timer tick, for the parallel port, which has no
+// interrupt of its own.
+void
+cons_tick(void)
+{
+	if (klog.serial_pos != klog.wpos || klog.lpt_pos != klog.wpos)
+		cons_drain();
+}
+
+// output n characters to the console
+void
+cons_write(const char *s, int n)
+{
+	int i;
+
+	spin_lock(&cons_lock);
+	for (i = 0; i < n; i++) {
+		klog_putc(s[i]);
+		cga_putc(s[i]);
+	}
+	cons_drain_locked();
+	spin_unlock(&cons_lock);
+}
+
+// Copy up to len bytes of the log, starting at log position *pos,
+// into buf.  Bytes that have already been overwritten are skipped, and
+// a position past the end of the log reads from the end.
+// Advances *pos past the bytes copied and returns how many there were.
+int
+klog_read(char *buf, size_t len, uint32_t *pos)
+{
+	uint32_t p, n;
+
+	spin_lock(&cons_lock);
+	p = *pos;
+	if (p > klog.wpos)
+		p = klog.wpos;
+	else if (klog.wpos - p > KLOG_SIZE)
+		p = klog.wpos - KLOG_SIZE;
+	for (n = 0; n < len && p != klog.wpos; n++)
+		buf[n] = klog.buf[p++ & (KLOG_SIZE - 1)];
+	*pos = p;
+	spin_unlock(&cons_lock);
+	return n;
 }
 
 // initialize the console devices
 void
 cons_init(void)
 {
+	spin_initlock(&cons_lock);
 	cga_init();
 	kbd_init();
 	serial_init();
@@ -456,7 +638,9 @@ cons_init(void)
 void
 cputchar(int c)
 {
-	cons_putc(c);
+	char ch = c;
+
+	cons_write(&ch, 1);
 }
 
 int
@@ -17,8 +17,17 @@
 #define CRT_COLS	80
 #define CRT_SIZE	(CRT_ROWS * CRT_COLS)
 
+// Size of the kernel log ring; must be a power of 2
+#define KLOG_SIZE	16384
+
 void cons_init(void);
 int cons_getc(void);
+void cons_write(const char *s, int n);
+void cons_tick(void);
+int klog_read(char *buf, size_t len, uint32_t *pos);
+
+struct Env;
+int cons_wait(struct Env *e);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
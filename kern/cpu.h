@@ -22,6 +22,11 @@ struct Cpu {
 	volatile unsigned cpu_status;   // The status of the CPU
 	struct Env *cpu_env;            // The currently-running environment.
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+	struct Page *cpu_reap;          // Page directories of freed envs awaiting
+	                                // teardown (linked by pp_link)
+	volatile uint32_t cpu_in_user;  // Set while running user code
+	volatile uint32_t cpu_tlb_req;  // TLB flushes requested of this CPU
+	volatile uint32_t cpu_tlb_done; // cpu_tlb_req as of its last flush
 };
 
 // Initialized in mpconfig.c
@@ -38,8 +43,9 @@ int cpunum(void);
 
 void mp_init(void);
 void lapic_init(void);
-void lapic_startap(uint8_t apicid, uint32_t addr);
+void lapic_startaps(uint32_t addr);
 void lapic_eoi(void);
 void lapic_ipi(int vector);
+void lapic_ipi_dest(uint8_t apicid, int vector);
 
 #endif
@@ -6,6 +6,7 @@
 #include <inc/string.h>
 #include <inc/assert.h>
 #include <inc/elf.h>
+#include <inc/lz4.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
@@ -14,12 +15,20 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/trace.h>
+#include <kern/fpu.h>
 
 struct Env *envs = NULL;		// All environments
 static struct Env *env_free_list;	// Free environment list
 					// (linked by Env->env_link)
+struct EnvList env_live_list;		// Allocated environments
+					// (linked by Env->env_live_link)
+uint32_t env_nlive;
+struct EnvRegistry *env_registry;	// Well-known envs, see inc/env.h
 
-#define ENVGENSHIFT	12		// >= LOGNENV
+#define ENVGENSHIFT	(LOG2NENV + 2)	// >= LOG2NENV
+
+#define debug 0
 
 // Global descriptor table.
 //
@@ -123,6 +132,7 @@ env_init(void)
 	// LAB 3: Your code here.
   int i;
 
+  LIST_INIT(&env_live_list);
   for(i=NENV-1; i>=0; i--) {
     envs[i].env_link = env_free_list;
     envs[i].env_id = 0;
@@ -243,6 +253,10 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	e->env_type = ENV_TYPE_USER;
 	e->env_status = ENV_RUNNABLE;
 	e->env_runs = 0;
+	e->env_snapshot = ENV_SNAP_NONE;
+	sched_env_init(e);
+	memset(&e->env_stats, 0, sizeof(e->env_stats));
+	fpu_env_init(e);
 
 	// Clear out all the saved register state,
 	// to prevent the register values
@@ -271,12 +285,18 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
     
 	// Clear the page fault handler until user installs one.
 	e->env_pgfault_upcall = 0;
+	e->env_fill_start = e->env_fill_end = 0;
+	e->env_fill_va = 0;
 
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
+	e->env_cons_waiting = 0;
+	e->env_irq_waiting = 0;
 
 	// commit the allocation
 	env_free_list = e->env_link;
+	LIST_INSERT_HEAD(&env_live_list, e, env_live_link);
+	env_nlive++;
 	*newenv_store = e;
     
     // why comment out this line?
@@ -312,7 +332,7 @@ region_alloc(struct Env *e, void *va, size_t len)
     //pte = pgdir_walk(e->env_pgdir,(void*)i, 1);
     pg = page_alloc(0);
     // pp_ref bug here
-    page_insert(e->env_pgdir, pg, (void*)i, PTE_U | PTE_W | PTE_P);
+    env_page_insert(e, pg, (void*)i, PTE_U | PTE_W | PTE_P);
     //if(*pte==0) panic("pte is null");
     //*pte |= (PTE_ADDR(page2pa(pg)) | PTE_U | PTE_W | PTE_P);
     i += PGSIZE;
@@ -320,6 +340,73 @@ region_alloc(struct Env *e, void *va, size_t len)
   
 }
 
+// Read-only pages of the embedded program images.  The first env
+// created from an image fills them; later ones just map them.  Each
+// entry holds a reference to its page, so cached pages stay resident.
+#define TEXT_CACHE_SIZE	1024	// Must be a power of 2
+
+struct TextPage {
+	const void *tp_image;	// Image the page belongs to; NULL if free
+	uintptr_t tp_va;	// Where the image maps it
+	struct Page *tp_page;
+};
+
+static struct TextPage text_cache[TEXT_CACHE_SIZE];
+
+// Find the text_cache entry for page 'va' of 'image', or the free
+// entry it should go in.  Returns NULL if the cache is full.
+static struct TextPage *
+text_cache_lookup(const void *image, uintptr_t va)
+{
+	uint32_t h = (uint32_t) image * 31 + PGNUM(va);
+	struct TextPage *tp;
+	int i;
+
+	for (i = 0; i < TEXT_CACHE_SIZE; i++) {
+		tp = &text_cache[(h + i) & (TEXT_CACHE_SIZE - 1)];
+		if (tp->tp_image == NULL ||
+		    (tp->tp_image == image && tp->tp_va == va))
+			return tp;
+	}
+	return NULL;
+}
+
+// Map the read-only segment 'ph' of 'binary' into e using the pages
+// cached for 'image', filling in any that are not cached yet.
+// Returns 0 on success, < 0 if the cache is full or out of memory,
+// in which case the caller loads the rest of the segment privately.
+static int
+load_shared(struct Env *e, uint8_t *binary, struct Proghdr *ph,
+	    const void *image)
+{
+	struct TextPage *tp;
+	struct Page *pp;
+	uintptr_t va, start, end;
+
+	for (va = ROUNDDOWN(ph->p_va, PGSIZE); va < ph->p_va + ph->p_memsz;
+	     va += PGSIZE) {
+		if (!(tp = text_cache_lookup(image, va)))
+			return -E_NO_MEM;
+		if (!tp->tp_image) {
+			if (!(pp = page_alloc(ALLOC_ZERO)))
+				return -E_NO_MEM;
+			start = MAX(va, ph->p_va);
+			end = MIN(va + PGSIZE, ph->p_va + ph->p_filesz);
+			if (start < end)
+				memmove(page2kva(pp) + (start - va),
+					binary + ph->p_offset + (start - ph->p_va),
+					end - start);
+			pp->pp_ref++;
+			tp->tp_image = image;
+			tp->tp_va = va;
+			tp->tp_page = pp;
+		}
+		if (env_page_insert(e, tp->tp_page, (void *) va, PTE_U | PTE_P) < 0)
+			return -E_NO_MEM;
+	}
+	return 0;
+}
+
 //
 // Set up the initial program binary, stack, and processor flags
 // for a user process.
@@ -339,11 +426,15 @@ region_alloc(struct Env *e, void *va, size_t len)
 //
 // Finally, this function maps one page for the program's initial stack.
 //
+// If 'image' is not NULL, it identifies the embedded image 'binary'
+// came from, and the pages of read-only segments are shared, read-only,
+// with every other env created from the same image (see text_cache).
+//
 // load_icode panics if it encounters problems.
 //  - How might load_icode fail?  What might be wrong with the given input?
 //
 static void
-load_icode(struct Env *e, uint8_t *binary, size_t size)
+load_icode(struct Env *e, uint8_t *binary, size_t size, const void *image)
 {
 	// Hints:
 	//  Load each program segment into virtual memory
@@ -377,25 +468,38 @@ load_icode(struct Env *e, uint8_t *binary, size_t size)
   
   struct Elf * elfhdr = (struct Elf *) binary;
   struct Proghdr *ph, *eph;
+  uintptr_t fend;
+
+  // use new env's va for convience; load_icode_lz4 passes a binary
+  // that is only mapped there (at UTEMP)
+  lcr3(PADDR(e->env_pgdir));
+
   if (elfhdr->e_magic != ELF_MAGIC)
     panic("elf magic is not correct\n");
   ph = (struct Proghdr *) ((uint8_t *) elfhdr + elfhdr->e_phoff);
 	eph = ph + elfhdr->e_phnum;
 
-  // use new env's va for convience
-  lcr3(PADDR(e->env_pgdir));
-
 	for (; ph < eph; ph++) {
     if (ph->p_type == ELF_PROG_LOAD) {
       if (ph->p_filesz > ph->p_memsz)
         panic("filesz > memsz\n");
       //cprintf("ph: va %x, memsz %x\n", ph->p_va, ph->p_memsz);
-      // allocate va [ph->va, ph->va + ph->p_memsz - 1]
-      region_alloc(e, (void*)ph->p_va, ph->p_memsz);
+      // allocate the pages holding file data, up to va + filesz
+      fend = MIN(ROUNDUP(ph->p_va + ph->p_filesz, PGSIZE),
+                 ph->p_va + ph->p_memsz);
+      if (image && !(ph->p_flags & ELF_PROG_FLAG_WRITE) &&
+          load_shared(e, binary, ph, image) == 0)
+        continue;
+      region_alloc(e, (void*)ph->p_va, fend - ph->p_va);
       // copy from elf to va
       memmove((void*)ph->p_va, binary+ph->p_offset, ph->p_filesz);
-      // padding zero to remaining va
-      memset((void*)ph->p_va + ph->p_filesz, 0, (ph->p_memsz - ph->p_filesz));
+      // padding zero to the end of the last file page
+      memset((void*)ph->p_va + ph->p_filesz, 0, fend - (ph->p_va + ph->p_filesz));
+      // the rest of bss is demand-zero
+      if (ph->p_va + ph->p_memsz > fend &&
+          env_page_reserve_range(e, fend, ROUNDUP(ph->p_va + ph->p_memsz, PGSIZE) - fend,
+                                 PTE_U | PTE_W | PTE_P) < 0)
+        panic("load_icode: out of memory\n");
     }
   }
   
@@ -413,6 +517,34 @@ load_icode(struct Env *e, uint8_t *binary, size_t size)
 
 }
 
+//
+// Load a program image stored compressed (see inc/lz4.h).
+// The image is expanded into scratch pages at UTEMP in the env's own
+// address space, so it needs no physically contiguous buffer, and
+// load_icode loads it from there.  The scratch pages are then freed.
+//
+static void
+load_icode_lz4(struct Env *e, uint8_t *binary, size_t size)
+{
+  struct Lz4Hdr *hdr = (struct Lz4Hdr *) binary;
+  uintptr_t va;
+  int r;
+
+  if (hdr->lz_size > PFTEMP - UTEMP)
+    panic("load_icode: image too large (%u bytes)\n", hdr->lz_size);
+  region_alloc(e, UTEMP, hdr->lz_size);
+
+  lcr3(PADDR(e->env_pgdir));
+  r = lz4_decompress(hdr + 1, size - sizeof(*hdr), UTEMP, hdr->lz_size);
+  lcr3(PADDR(kern_pgdir));
+  if (r < 0 || r != hdr->lz_size)
+    panic("load_icode: corrupt compressed image\n");
+
+  load_icode(e, UTEMP, r, binary);
+  for (va = (uintptr_t) UTEMP; va < (uintptr_t) UTEMP + r; va += PGSIZE)
+    env_page_remove(e, (void *) va);
+}
+
 //
 // Allocates a new env with env_alloc, loads the named elf
 // binary into it with load_icode, and sets its env_type.
@@ -437,7 +569,11 @@ env_create(uint8_t *binary, size_t size, enum EnvType type)
      *   panic("memory exhaustion\n");
      */
   }
-  load_icode(e, binary, size);
+  if (size >= sizeof(struct Lz4Hdr) &&
+      ((struct Lz4Hdr *) binary)->lz_magic == LZ4_MAGIC)
+    load_icode_lz4(e, binary, size);
+  else
+    load_icode(e, binary, size, binary);
   e->env_type = type;
 
 	// If this is the file server (type == ENV_TYPE_FS) give it I/O privileges.
@@ -446,61 +582,174 @@ env_create(uint8_t *binary, size_t size, enum EnvType type)
   if (type == ENV_TYPE_FS) {
     e->env_tf.tf_eflags |= FL_IOPL_3; // CPL <= IOPL
   }
+
+  // System servers sit on every client's critical path; let them
+  // run ahead of CPU-bound user envs.
+  if (type == ENV_TYPE_FS || type == ENV_TYPE_NS)
+    e->env_sched_class = ENV_SCHED_SYSTEM;
+
+  // Publish the first env of each special type so clients can find
+  // it with ipc_find_env without scanning envs[].
+  if (type != ENV_TYPE_USER && type != ENV_TYPE_IDLE &&
+      env_registry->reg_bytype[type] == 0)
+    env_registry->reg_bytype[type] = e->env_id;
 }
 
 //
-// Frees env e and all memory it uses.
+// Register env e under 'name' in the service registry.
 //
-void
-env_free(struct Env *e)
+// RETURNS
+//   0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if name is empty, too long, or already taken by
+//		another env.
+//	-E_NO_MEM if the registry is full.
+//
+int
+env_register(struct Env *e, const char *name)
+{
+	struct EnvService *sv, *empty = NULL;
+	int i;
+
+	if (name[0] == '\0' || strlen(name) >= SERVICE_NAMELEN)
+		return -E_INVAL;
+	for (i = 0; i < NSERVICE; i++) {
+		sv = &env_registry->reg_names[i];
+		if (sv->sv_name[0] == '\0') {
+			if (!empty)
+				empty = sv;
+		} else if (strcmp(sv->sv_name, name) == 0)
+			return sv->sv_envid == e->env_id ? 0 : -E_INVAL;
+	}
+	if (!empty)
+		return -E_NO_MEM;
+	empty->sv_envid = e->env_id;
+	strcpy(empty->sv_name, name);
+	return 0;
+}
+
+// Drop every registry entry that refers to e.
+static void
+env_unregister(struct Env *e)
+{
+	int i;
+
+	for (i = 0; i < ENV_NTYPES; i++)
+		if (env_registry->reg_bytype[i] == e->env_id)
+			env_registry->reg_bytype[i] = 0;
+	for (i = 0; i < NSERVICE; i++)
+		if (env_registry->reg_names[i].sv_envid == e->env_id) {
+			env_registry->reg_names[i].sv_name[0] = '\0';
+			env_registry->reg_names[i].sv_envid = 0;
+		}
+}
+
+// Drop the references held by the user mappings of the dead page
+// directory 'pgdir' and clear them.  The page tables themselves stay
+// for env_reap.
+static void
+pgdir_drop_pages(pde_t *pgdir)
 {
 	pte_t *pt;
 	uint32_t pdeno, pteno;
-	physaddr_t pa;
+
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (!(pgdir[pdeno] & PTE_P))
+			continue;
+		pt = (pte_t *) KADDR(PTE_ADDR(pgdir[pdeno]));
+		for (pteno = 0; pteno < NPTENTRIES; pteno++)
+			if (pt[pteno] & PTE_P) {
+				page_decref(pa2page(PTE_ADDR(pt[pteno])));
+				pt[pteno] = 0;
+			}
+	}
+}
+
+//
+// Frees env e.
+// The Env slot is returned to the free list right away, and so are the
+// env's references to its pages, so that pageref() (pipes, the file
+// server's open files) sees it gone at once.  Only its page tables and
+// page directory are queued on this CPU's reap list; env_reap frees
+// them later, outside of the exit path.
+//
+void
+env_free(struct Env *e)
+{
+	struct Page *pp;
 
 	// If freeing the current environment, switch to kern_pgdir
-	// before freeing the page directory, just in case the page
-	// gets reused.
+	// before queueing the page directory, since the reaper will
+	// free it.  No other CPU can have it loaded: a running env is
+	// only freed by the CPU that runs it.
 	if (e == curenv)
 		lcr3(PADDR(kern_pgdir));
 
 	// Note the environment's demise.
-	cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
-
-	// Flush all mapped pages in the user portion of the address space
-	static_assert(UTOP % PTSIZE == 0);
-	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
-
-		// only look at mapped page tables
-		if (!(e->env_pgdir[pdeno] & PTE_P))
-			continue;
+	if (debug)
+		cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
-		// find the pa and va of the page table
-		pa = PTE_ADDR(e->env_pgdir[pdeno]);
-		pt = (pte_t*) KADDR(pa);
+	pgdir_drop_pages(e->env_pgdir);
 
-		// unmap all PTEs in this page table
-		for (pteno = 0; pteno <= PTX(~0); pteno++) {
-			if (pt[pteno] & PTE_P)
-				page_remove(e->env_pgdir, PGADDR(pdeno, pteno, 0));
-		}
-
-		// free the page table itself
-		e->env_pgdir[pdeno] = 0;
-		page_decref(pa2page(pa));
-	}
-
-	// free the page directory
-	pa = PADDR(e->env_pgdir);
+	// The page directory page's pp_link is unused while it is
+	// allocated, so it can link the reap list.
+	pp = pa2page(PADDR(e->env_pgdir));
+	pp->pp_link = thiscpu->cpu_reap;
+	thiscpu->cpu_reap = pp;
 	e->env_pgdir = 0;
-	page_decref(pa2page(pa));
+	e->env_stats.es_npages = 0;
+
+	env_unregister(e);
 
 	// return the environment to the free list
+	LIST_REMOVE(e, env_live_link);
+	env_nlive--;
 	e->env_status = ENV_FREE;
 	e->env_link = env_free_list;
 	env_free_list = e;
 }
 
+// Free at most '*budget' of the user page tables of the dead page
+// directory 'pgdir', whose pages env_free has already dropped.  The
+// address space is no longer loaded anywhere, so no TLB invalidation
+// is needed.  Returns true once no user page tables are left.
+static bool
+pgdir_reap(pde_t *pgdir, int *budget)
+{
+	uint32_t pdeno;
+	physaddr_t pa;
+
+	static_assert(UTOP % PTSIZE == 0);
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (!(pgdir[pdeno] & PTE_P))
+			continue;
+		if (*budget == 0)
+			return 0;
+
+		pa = PTE_ADDR(pgdir[pdeno]);
+		pgdir[pdeno] = 0;
+		page_decref(pa2page(pa));
+		(*budget)--;
+	}
+	return 1;
+}
+
+// Tear down address spaces queued on CPU c's reap list, freeing at
+// most 'budget' page tables, or all of them if 'budget' is negative.
+// Callers must hold the kernel lock.
+void
+env_reap(struct Cpu *c, int budget)
+{
+	struct Page *pp;
+
+	while ((pp = c->cpu_reap) != NULL) {
+		if (!pgdir_reap((pde_t *) page2kva(pp), &budget))
+			return;
+		c->cpu_reap = pp->pp_link;
+		pp->pp_link = NULL;
+		page_decref(pp);
+	}
+}
+
 //
 // Frees environment e.
 // If e was the current env, then runs a new environment (and does not return
@@ -577,6 +826,8 @@ env_run(struct Env *e)
 	// LAB 3: Your code here.
 
 	//panic("env_run not yet implemented");
+  if (curenv != e)
+    TRACE(TRACE_SWITCH, 0, e->env_id, 0, 0, 0, 0);
   if (curenv != NULL) {
     if (curenv->env_status == ENV_RUNNING) {
     curenv->env_status = ENV_RUNNABLE;
@@ -589,8 +840,12 @@ env_run(struct Env *e)
   //cprintf("env_run env_id %x\n", curenv->env_id);
   //cprintf("env_run eip 0x%x\n", curenv->env_tf.tf_eip);
 
+  // From here on, TLB shootdowns must reach us by IPI (see pmap.c).
+  xchg(&thiscpu->cpu_in_user, 1);
   unlock_kernel();
   lcr3(PADDR(e->env_pgdir));
+  e->env_run_start = read_tsc();
+  fpu_restore(e);
   //cprintf("env_run p1\n");
   env_pop_tf(&(e->env_tf));
   //cprintf("env_run p2\n");
@@ -598,16 +853,15 @@ env_run(struct Env *e)
 }
 
 void print_envs(int only_run) {
-  int i;
-  for (i = 0; i < NENV; i++) {
+  struct Env *e;
+  LIST_FOREACH(e, &env_live_list, env_live_link) {
+    if (e->env_type == ENV_TYPE_IDLE)
+      continue;
     if (only_run) {
-      if (envs[i].env_type != ENV_TYPE_IDLE &&
-          envs[i].env_status == ENV_RUNNING)
-        cprintf("envs[%d] is running on cpu[%d]\n", i, envs[i].env_cpunum);
+      if (e->env_status == ENV_RUNNING)
+        cprintf("envs[%d] is running on cpu[%d]\n", ENVX(e->env_id), e->env_cpunum);
     } else {
-      if (envs[i].env_type != ENV_TYPE_IDLE)
-        cprintf("envs[%d] is %d\n", i, envs[i].env_status);
-      
-    }   
+      cprintf("envs[%d] is %d\n", ENVX(e->env_id), e->env_status);
+    }
   }
 }
@@ -7,6 +7,10 @@
 #include <kern/cpu.h>
 
 extern struct Env *envs;		// All environments
+LIST_HEAD(EnvList, Env);
+extern struct EnvList env_live_list;	// Allocated environments
+extern uint32_t env_nlive;		// Length of env_live_list
+extern struct EnvRegistry *env_registry;	// Mapped at USERVICES
 #define curenv (thiscpu->cpu_env)		// Current environment
 extern struct Segdesc gdt[];
 
@@ -14,9 +18,11 @@ void	env_init(void);
 void	env_init_percpu(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
 void	env_free(struct Env *e);
+void	env_reap(struct Cpu *c, int budget);
 void	env_create(uint8_t *binary, size_t size, enum EnvType type);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
 void print_envs(int only_run);
+int	env_register(struct Env *e, const char *name);
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 // The following two functions do not return
@@ -27,12 +33,14 @@ void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
 // ENV_CREATE because of the C pre-processor's argument prescan rule.
 #define ENV_PASTE3(x, y, z) x ## y ## z
 
+// The embedded images are the compressed obj/<x>.lz files
+// (see kern/Makefrag).
 #define ENV_CREATE(x, type)						\
 	do {								\
-		extern uint8_t ENV_PASTE3(_binary_obj_, x, _start)[],	\
-			ENV_PASTE3(_binary_obj_, x, _size)[];		\
-		env_create(ENV_PASTE3(_binary_obj_, x, _start),		\
-			   (int)ENV_PASTE3(_binary_obj_, x, _size),	\
+		extern uint8_t ENV_PASTE3(_binary_obj_, x, _lz_start)[],	\
+			ENV_PASTE3(_binary_obj_, x, _lz_size)[];	\
+		env_create(ENV_PASTE3(_binary_obj_, x, _lz_start),	\
+			   (int)ENV_PASTE3(_binary_obj_, x, _lz_size),	\
 			   type);					\
 	} while (0)
 
@@ -0,0 +1,56 @@
+// x87/SSE state management.
+
+#include <inc/types.h>
+#include <inc/string.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
+
+#include <kern/fpu.h>
+
+// Set once FXSAVE and SSE2 have been enabled.  Every CPU in a JOS
+// machine is assumed to have the same features.
+static bool fpu_fxsr;
+
+// Enable the FPU and, if the CPU has them, FXSAVE and SSE on this CPU.
+// Must run before this CPU calls anything in lib/string.c.
+void
+fpu_init_percpu(void)
+{
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & CPUID_FEAT_FXSR) || !(edx & CPUID_FEAT_SSE2))
+		return;
+
+	lcr0((rcr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+	lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	asm volatile("fninit");
+	fpu_fxsr = 1;
+}
+
+// Give a new env the state fninit leaves behind: all exceptions
+// masked, round to nearest.
+void
+fpu_env_init(struct Env *e)
+{
+	memset(&e->env_fpu, 0, sizeof(e->env_fpu));
+	e->env_fpu.fx_fcw = 0x037F;
+	e->env_fpu.fx_mxcsr = 0x1F80;
+}
+
+// Save the registers of 'e', which just trapped into the kernel on
+// this CPU.  Must run before the kernel uses any SSE register.
+void
+fpu_save(struct Env *e)
+{
+	if (fpu_fxsr)
+		asm volatile("fxsave %0" : "=m" (e->env_fpu));
+}
+
+// Load the registers of 'e' just before returning to it.
+void
+fpu_restore(struct Env *e)
+{
+	if (fpu_fxsr)
+		asm volatile("fxrstor %0" : : "m" (e->env_fpu));
+}
@@ -0,0 +1,18 @@
+#ifndef JOS_KERN_FPU_H
+#define JOS_KERN_FPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+// The kernel's memmove and memset use SSE registers, so an env's
+// x87/SSE state is saved on every entry from user mode and restored
+// by env_run, rather than switched lazily on first use.
+
+void fpu_init_percpu(void);
+void fpu_env_init(struct Env *e);
+void fpu_save(struct Env *e);
+void fpu_restore(struct Env *e);
+
+#endif	// !JOS_KERN_FPU_H
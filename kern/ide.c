@@ -0,0 +1,161 @@
+// Bus-master DMA for the primary IDE channel.
+
+#include <inc/x86.h>
+#include <inc/error.h>
+
+#include <kern/ide.h>
+#include <kern/pci.h>
+#include <kern/pcireg.h>
+#include <kern/pmap.h>
+#include <kern/env.h>
+
+// Bus master registers, relative to the channel's base
+#define BMICOM		0	// Command: start/stop, direction
+#define BMISTA		2	// Status
+#define BMIDTP		4	// PRD table physical address
+
+#define BMICOM_READ	0x08	// Device to memory (a disk read)
+#define BMISTA_ACTIVE	0x01
+#define BMISTA_ERR	0x02
+#define BMISTA_INTR	0x04
+
+// Physical Region Descriptor: one physically contiguous piece of the
+// transfer buffer.  It may not cross a 64KB boundary.
+struct Prd {
+	uint32_t prd_addr;
+	uint16_t prd_len;		// Bytes; 0 means 64KB
+	uint16_t prd_flags;
+};
+#define PRD_EOT		0x8000		// Last entry of the table
+
+// The bus master's I/O base for the primary channel, or 0 if there
+// is no bus master IDE controller.
+static uint16_t ide_bmbase;
+
+// The PRD table, one page of it.  A page-aligned table never crosses
+// a 64KB boundary, which the controller does not allow.
+static struct Prd *ide_prd;
+static physaddr_t ide_prd_pa;
+
+// The pages of the transfer the PRD table describes.  The controller
+// uses their physical addresses until the transfer ends, so they hold
+// a reference each: an env that unmaps them or dies meanwhile cannot
+// have them reused under the transfer.
+#define IDE_MAXPAGES	(256 * 512 / PGSIZE)
+static struct Page *ide_pages[IDE_MAXPAGES];
+static int ide_npages;
+
+// Drop the references on the pages of the last transfer.
+static void
+ide_dma_release(void)
+{
+	while (ide_npages > 0)
+		page_decref(ide_pages[--ide_npages]);
+}
+
+int
+ide_pci_attach(struct pci_func *f)
+{
+	struct Page *pg;
+
+	pci_func_enable(f);
+	// The file server drives the primary channel at the legacy ports
+	// and IRQ 14, so a controller whose primary channel is in native
+	// mode (interface bit 0), or that has no I/O bus master region,
+	// is left to PIO.
+	if (PCI_INTERFACE(f->dev_class) & 0x01)
+		return 0;
+	if (!f->reg_base[4] || f->reg_size[4] < 16 || f->reg_base[4] > 0xFFFF)
+		return 0;
+	if (!(pg = page_alloc(ALLOC_ZERO)))
+		return 0;
+	pg->pp_ref++;
+	ide_prd = page2kva(pg);
+	ide_prd_pa = page2pa(pg);
+	ide_bmbase = f->reg_base[4];
+
+	// Tell the controller both drives can do DMA (status bits 5-6),
+	// which the BIOS may not have done.
+	outb(ide_bmbase + BMISTA, inb(ide_bmbase + BMISTA) | 0x60);
+	cprintf("ide: bus master DMA at port 0x%x\n", ide_bmbase);
+	return 1;
+}
+
+// Load the PRD table with the pages of [va, va+len) in env e and arm
+// the bus master for a transfer to the disk if 'todisk' is set, or
+// from it.  The buffer must be page-aligned, and mapped user-writable
+// when the disk writes into it.  The caller then issues the DMA
+// command to the drive and sets the start bit in BMICOM; completion
+// raises IRQ 14 like any other command.  The pages stay referenced
+// until ide_dma_intr sees the transfer end, or the next call.
+//
+// Returns the bus master's I/O base on success, < 0 on error.  Errors:
+//	-E_NOT_SUPP if there is no bus master IDE controller.
+//	-E_INVAL if the buffer is not aligned, is larger than one IDE
+//		command can transfer, or is not mapped with the
+//		needed permissions.
+int
+ide_dma_prepare(struct Env *e, void *va, size_t len, bool todisk)
+{
+	struct Page *pg;
+	pte_t *pte;
+	int perm = PTE_P | PTE_U | (todisk ? 0 : PTE_W);
+	size_t off, n = 0;
+	physaddr_t pa;
+
+	if (!ide_bmbase)
+		return -E_NOT_SUPP;
+	if ((uintptr_t) va % PGSIZE || len == 0 || len % 512 ||
+	    len > 256 * 512 || (uintptr_t) va >= UTOP ||
+	    (uintptr_t) va + len > UTOP)
+		return -E_INVAL;
+
+	// The previous transfer has ended, or its driver gave up on it;
+	// make sure the controller is done with its pages.
+	outb(ide_bmbase + BMICOM, 0);
+	ide_dma_release();
+
+	for (off = 0; off < len; off += PGSIZE) {
+		if (!(pg = page_lookup(e->env_pgdir, va + off, &pte)) ||
+		    (*pte & perm) != perm) {
+			ide_dma_release();
+			return -E_INVAL;
+		}
+		pg->pp_ref++;
+		ide_pages[ide_npages++] = pg;
+		pa = page2pa(pg);
+		// Merge physically contiguous pages, within a 64KB window.
+		if (n > 0 && ide_prd[n-1].prd_addr + ide_prd[n-1].prd_len == pa &&
+		    pa % 0x10000 != 0)
+			ide_prd[n-1].prd_len += MIN(PGSIZE, len - off);
+		else {
+			ide_prd[n].prd_addr = pa;
+			ide_prd[n].prd_len = MIN(PGSIZE, len - off);
+			ide_prd[n].prd_flags = 0;
+			n++;
+		}
+	}
+	ide_prd[n-1].prd_flags = PRD_EOT;
+
+	outb(ide_bmbase + BMICOM, todisk ? 0 : BMICOM_READ);
+	outl(ide_bmbase + BMIDTP, ide_prd_pa);
+	// Writing 1 clears the interrupt and error bits.
+	outb(ide_bmbase + BMISTA,
+	     inb(ide_bmbase + BMISTA) | BMISTA_INTR | BMISTA_ERR);
+	return ide_bmbase;
+}
+
+// Called on IRQ 14: once the bus master reports the transfer over,
+// the kernel no longer needs to keep its pages.  The status bits are
+// left for the driver to see and clear.
+void
+ide_dma_intr(void)
+{
+	uint8_t s;
+
+	if (!ide_bmbase || ide_npages == 0)
+		return;
+	s = inb(ide_bmbase + BMISTA);
+	if ((s & (BMISTA_INTR | BMISTA_ERR)) && !(s & BMISTA_ACTIVE))
+		ide_dma_release();
+}
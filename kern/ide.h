@@ -0,0 +1,20 @@
+#ifndef JOS_KERN_IDE_H
+#define JOS_KERN_IDE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// PCI bus-master IDE (PIIX) support.  The file server drives the disk
+// itself, but DMA needs physical addresses, so the kernel owns the
+// PRD table and fills it in from the file server's pages.
+
+struct pci_func;
+struct Env;
+
+int ide_pci_attach(struct pci_func *f);
+int ide_dma_prepare(struct Env *e, void *va, size_t len, bool todisk);
+void ide_dma_intr(void);
+
+#endif	// !JOS_KERN_IDE_H
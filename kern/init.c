@@ -3,6 +3,7 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/x86.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
@@ -16,30 +17,63 @@
 #include <kern/spinlock.h>
 #include <kern/time.h>
 #include <kern/pci.h>
+#include <kern/fpu.h>
 
 static void boot_aps(void);
+static void boot_phase(const char *name);
+static void boot_report(void);
+
+// Boot phase timestamps, reported just before the first env runs.
+#define NBOOTPHASE	10
+
+static struct {
+	const char *bp_name;
+	uint64_t bp_tsc;		// TSC at the end of the phase
+} boot_phases[NBOOTPHASE];
+static int nboot_phases;
 
 
 void
 i386_init(void)
 {
   extern char edata[], end[];
+  uint64_t start = read_tsc();
+  uint64_t *loader = (uint64_t *) (KERNBASE + BOOTTSC_PADDR);
 
   // Before doing anything else, complete the ELF loading process.
   // Clear the uninitialized global data (BSS) section of our program.
   // This ensures that all static/global variables start out zero.
   memset(edata, 0, end - edata);
 
+  // Time the boot loader too if it left its TSC readings behind.
+  if (loader[0] && loader[0] < loader[1] && loader[1] < start) {
+    boot_phases[0].bp_name = "loader";
+    boot_phases[0].bp_tsc = loader[0];
+    boot_phases[1].bp_name = "load";
+    boot_phases[1].bp_tsc = loader[1];
+    nboot_phases = 2;
+  }
+  boot_phases[nboot_phases].bp_name = "entry";
+  boot_phases[nboot_phases].bp_tsc = start;
+  nboot_phases++;
+
+  // Turn on SSE so that memmove and memset can use it.
+  fpu_init_percpu();
+  string_init();
+
   // Initialize the console.
   // Can't call cprintf until after we do this!
   cons_init();
+  boot_phase("console");
 
   // Lab 2 memory management initialization functions
   mem_init();
+  boot_phase("memory");
 
   // Lab 3 user environment initialization functions
   env_init();
   trap_init();
+  boot_phase("env/trap");
 
 	// Lab 4 multiprocessor initialization functions
 	mp_init();
@@ -47,10 +81,12 @@ i386_init(void)
 
 	// Lab 4 multitasking initialization functions
 	pic_init();
+	boot_phase("mp/pic");
 
 	// Lab 6 hardware initialization functions
 	time_init();
 	pci_init();
+	boot_phase("devices");
 
 	// Acquire the big kernel lock before waking up APs
 	// Your code here:
@@ -58,6 +94,7 @@ i386_init(void)
     
 	// Starting non-boot CPUs
 	boot_aps();
+	boot_phase("aps");
 
 	// Should always have idle processes at first.
 	int i;
@@ -107,15 +144,40 @@ i386_init(void)
 	// ENV_CREATE(user_icode, ENV_TYPE_USER);
 	//ENV_CREATE(user_primes, ENV_TYPE_USER);
 #endif // TEST*
+	boot_phase("envs");
+	boot_report();
 
 	// Schedule and run the first user environment!
 	sched_yield();
 }
 
-// While boot_aps is booting a given CPU, it communicates the per-core
-// stack pointer that should be loaded by mpentry.S to that CPU in
-// this variable.
-void *mpentry_kstack;
+static void
+boot_phase(const char *name)
+{
+	if (nboot_phases == NBOOTPHASE)
+		return;
+	boot_phases[nboot_phases].bp_name = name;
+	boot_phases[nboot_phases].bp_tsc = read_tsc();
+	nboot_phases++;
+}
+
+static void
+boot_report(void)
+{
+	uint64_t base = boot_phases[0].bp_tsc;
+	int i;
+
+	cprintf("boot: %d CPU(s), phase cycles (cumulative):\n", ncpu);
+	for (i = 1; i < nboot_phases; i++)
+		cprintf("boot:   %-8s %12llu  (%llu)\n", boot_phases[i].bp_name,
+			boot_phases[i].bp_tsc - boot_phases[i-1].bp_tsc,
+			boot_phases[i].bp_tsc - base);
+}
+
+// The stack mpentry.S should load on each AP, indexed by local APIC
+// ID.  All APs start at once, so each must be able to find its own.
+// APs without an entry here (not in cpus[]) halt.
+void *mpentry_kstacks[256];
 
 // Start the non-boot (AP) processors.
 static void
@@ -125,23 +187,25 @@ boot_aps(void)
 	void *code;
 	struct Cpu *c;
 
+	if (ncpu == 1)
+		return;
+
 	// Write entry code to unused memory at MPENTRY_PADDR
 	code = KADDR(MPENTRY_PADDR);
 	memmove(code, mpentry_start, mpentry_end - mpentry_start);
 
-	// Boot each AP one at a time
-	for (c = cpus; c < cpus + ncpu; c++) {
-		if (c == cpus + cpunum())  // We've started already.
-			continue;
-
-		// Tell mpentry.S what stack to use 
-		mpentry_kstack = percpu_kstacks[c - cpus] + KSTKSIZE;
-		// Start the CPU at mpentry_start
-		lapic_startap(c->cpu_id, PADDR(code));
-		// Wait for the CPU to finish some basic setup in mp_main()
-		while(c->cpu_status != CPU_STARTED)
+	// Tell mpentry.S what stack each AP should use
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (c != cpus + cpunum())  // We've started already.
+			mpentry_kstacks[c->cpu_id] =
+				percpu_kstacks[c - cpus] + KSTKSIZE;
+
+	// Start all APs at mpentry_start together, then wait for them
+	// to finish their basic setup in mp_main() in parallel.
+	lapic_startaps(PADDR(code));
+	for (c = cpus; c < cpus + ncpu; c++)
+		while (c->cpu_status != CPU_STARTED)
 			;
-	}
 }
 
 // Setup code for APs
@@ -150,6 +214,7 @@ mp_main(void)
 {
 	// We are in high EIP now, safe to switch to kern_pgdir 
 	lcr3(PADDR(kern_pgdir));
+	fpu_init_percpu();
 	cprintf("SMP: CPU %d starting\n", cpunum());
 
 	lapic_init();
@@ -131,10 +131,12 @@ microdelay(int us)
 
 #define IO_RTC  0x70
 
-// Start additional processor running entry code at addr.
-// See Appendix B of MultiProcessor Specification.
+// Start all other processors running entry code at addr at once.
+// See Appendix B of MultiProcessor Specification.  Each AP finds its
+// own stack by its APIC ID (see mpentry.S), so they need not be
+// started one at a time.
 void
-lapic_startap(uint8_t apicid, uint32_t addr)
+lapic_startaps(uint32_t addr)
 {
 	int i;
 	uint16_t *wrv;
@@ -149,21 +151,26 @@ lapic_startap(uint8_t apicid, uint32_t addr)
 	wrv[1] = addr >> 4;
 
 	// "Universal startup algorithm."
-	// Send INIT (level-triggered) interrupt to reset other CPU.
-	lapicw(ICRHI, apicid << 24);
-	lapicw(ICRLO, INIT | LEVEL | ASSERT);
+	// Broadcast INIT (level-triggered) to reset every other CPU.
+	lapicw(ICRHI, 0);
+	lapicw(ICRLO, OTHERS | INIT | LEVEL | ASSERT);
+	while (lapic[ICRLO] & DELIVS)
+		;
 	microdelay(200);
-	lapicw(ICRLO, INIT | LEVEL);
+	lapicw(ICRLO, OTHERS | INIT | LEVEL);
+	while (lapic[ICRLO] & DELIVS)
+		;
 	microdelay(100);    // should be 10ms, but too slow in Bochs!
 
-	// Send startup IPI (twice!) to enter code.
+	// Broadcast startup IPI (twice!) to enter code.
 	// Regular hardware is supposed to only accept a STARTUP
 	// when it is in the halted state due to an INIT.  So the second
 	// should be ignored, but it is part of the official Intel algorithm.
 	// Bochs complains about the second one.  Too bad for Bochs.
 	for (i = 0; i < 2; i++) {
-		lapicw(ICRHI, apicid << 24);
-		lapicw(ICRLO, STARTUP | (addr >> 12));
+		lapicw(ICRLO, OTHERS | STARTUP | (addr >> 12));
+		while (lapic[ICRLO] & DELIVS)
+			;
 		microdelay(200);
 	}
 }
@@ -175,3 +182,13 @@ lapic_ipi(int vector)
 	while (lapic[ICRLO] & DELIVS)
 		;
 }
+
+// Send an IPI with 'vector' to the CPU with local APIC ID 'apicid'.
+void
+lapic_ipi_dest(uint8_t apicid, int vector)
+{
+	lapicw(ICRHI, apicid << 24);
+	lapicw(ICRLO, FIXED | vector);
+	while (lapic[ICRLO] & DELIVS)
+		;
+}
@@ -0,0 +1,147 @@
+/*
+ * Compress a program image for embedding in the kernel.
+ * Usage: lz4pack input output
+ *
+ * The output is an Lz4Hdr followed by a single LZ4 block, which
+ * env_create expands with lz4_decompress.  Compression is the usual
+ * greedy single-probe hash search: fast, and good enough for ELF files
+ * with lots of zero padding and repeated code.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Prevent inc/types.h, included from inc/lz4.h,
+// from attempting to redefine types defined in the host's inttypes.h.
+#define JOS_INC_TYPES_H
+#include <inc/lz4.h>
+
+#define HASH_LOG	16
+
+static uint32_t table[1 << HASH_LOG];
+
+static uint32_t
+read32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint32_t
+hash(const uint8_t *p)
+{
+	return (read32(p) * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// Write 'len' in the token nibble at 'token' and extension bytes.
+static uint8_t *
+put_length(uint8_t *op, uint8_t *token, size_t len, int shift)
+{
+	if (len < 15) {
+		*token |= len << shift;
+		return op;
+	}
+	*token |= 15 << shift;
+	for (len -= 15; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+static uint8_t *
+put_sequence(uint8_t *op, const uint8_t *lit, size_t nlit,
+	     size_t off, size_t mlen)
+{
+	uint8_t *token = op++;
+
+	*token = 0;
+	op = put_length(op, token, nlit, 4);
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if (mlen == 0)
+		return op;
+	*op++ = off;
+	*op++ = off >> 8;
+	return put_length(op, token, mlen - LZ4_MINMATCH, 0);
+}
+
+// Compress 'n' bytes at 'src' into 'dst', which must have room for
+// the worst case.  Returns the compressed size.
+static size_t
+compress(const uint8_t *src, size_t n, uint8_t *dst)
+{
+	const uint8_t *ip = src, *anchor = src, *ref;
+	const uint8_t *mflimit = src + n - LZ4_MFLIMIT;
+	const uint8_t *mlimit = src + n - LZ4_LASTLITERALS;
+	uint8_t *op = dst;
+	uint32_t h;
+	size_t len;
+
+	if (n < LZ4_MFLIMIT + 1)
+		return put_sequence(op, src, n, 0, 0) - dst;
+
+	memset(table, 0, sizeof(table));
+	while (ip < mflimit) {
+		h = hash(ip);
+		ref = src + table[h];
+		table[h] = ip - src;
+		if (ref >= ip || ip - ref > LZ4_WINDOW ||
+		    read32(ref) != read32(ip)) {
+			ip++;
+			continue;
+		}
+
+		len = LZ4_MINMATCH;
+		while (ip + len < mlimit && ref[len] == ip[len])
+			len++;
+		op = put_sequence(op, anchor, ip - anchor, ip - ref, len);
+		ip += len;
+		anchor = ip;
+	}
+	return put_sequence(op, anchor, src + n - anchor, 0, 0) - dst;
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *f;
+	uint8_t *src, *dst;
+	long n;
+	size_t m;
+	struct Lz4Hdr hdr;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: lz4pack input output\n");
+		exit(2);
+	}
+
+	if ((f = fopen(argv[1], "rb")) == NULL ||
+	    fseek(f, 0, SEEK_END) < 0 || (n = ftell(f)) < 0) {
+		perror(argv[1]);
+		exit(1);
+	}
+	rewind(f);
+	src = malloc(n + 1);
+	dst = malloc(n + n / 255 + 16);
+	if (!src || !dst) {
+		fprintf(stderr, "lz4pack: out of memory\n");
+		exit(1);
+	}
+	if (fread(src, 1, n, f) != (size_t) n) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fclose(f);
+
+	m = compress(src, n, dst);
+	hdr.lz_magic = LZ4_MAGIC;
+	hdr.lz_size = n;
+	if ((f = fopen(argv[2], "wb")) == NULL ||
+	    fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(dst, 1, m, f) != m || fclose(f) != 0) {
+		perror(argv[2]);
+		exit(1);
+	}
+	return 0;
+}
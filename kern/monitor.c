@@ -11,6 +11,8 @@
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
 #include <kern/trap.h>
+#include <kern/trace.h>
+#include <kern/prof.h>
 
 #include <kern/pmap.h>
 
@@ -31,6 +33,9 @@ static struct Command commands[] = {
   { "map", "Display virtual to physical address mapping", mon_map},
   { "perm", "set/clear permission of virtual address", mon_perm},
   { "dump", "dump memory content according to p)hysical v)irtual address", mon_dump},
+  { "trace", "Dump/filter the kernel event trace, or clear/on/off", mon_trace},
+  { "prof", "Start/stop the sampling profiler, print flat/graph profile", mon_prof},
+  { "continue", "Leave the monitor and resume the trapped env", mon_continue},
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -186,6 +191,100 @@ int mon_dump(int argc, char **argv, struct Trapframe *tf) {
   return 0;
 }
 
+// Usage: $ trace
+//        Dump the last 32 events from all CPUs, merged by time
+//        $ trace cpu 1 type syscall env 0x1001 last 100
+//        Only events from CPU 1, of one type, for one env
+//        $ trace clear
+//        $ trace off syscall
+//        $ trace on
+//        Stop/start recording one type (or all types)
+int mon_trace(int argc, char **argv, struct Trapframe *tf) {
+  int i, t, cpu = -1, count = 32;
+  uint32_t mask = TRACE_ALL;
+  envid_t env = 0;
+
+  if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+    trace_clear();
+    return 0;
+  }
+  if (argc > 1 && (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0)) {
+    mask = TRACE_ALL;
+    if (argc > 2) {
+      if ((t = trace_type(argv[2])) < 0) {
+        cprintf("Unknown event type '%s'\n", argv[2]);
+        return 1;
+      }
+      mask = TRACE_BIT(t);
+    }
+    if (argv[1][1] == 'n')
+      trace_mask |= mask;
+    else
+      trace_mask &= ~mask;
+    return 0;
+  }
+
+  for (i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "cpu") == 0)
+      cpu = strtol(argv[i+1], 0, 0);
+    else if (strcmp(argv[i], "env") == 0)
+      env = strtol(argv[i+1], 0, 0);
+    else if (strcmp(argv[i], "last") == 0)
+      count = strtol(argv[i+1], 0, 0);
+    else if (strcmp(argv[i], "type") == 0) {
+      if ((t = trace_type(argv[i+1])) < 0) {
+        cprintf("Unknown event type '%s'\n", argv[i+1]);
+        return 1;
+      }
+      mask = TRACE_BIT(t);
+    } else
+      break;
+  }
+  if (i < argc) {
+    cprintf("Usage: trace [cpu N] [type T] [env ID] [last N] | clear | on/off [T]\n");
+    return 1;
+  }
+
+  trace_dump(cpu, mask, env, count);
+  return 0;
+}
+// Usage: $ prof start
+//        Clear old samples, sample EIP and 3 return addresses per tick
+//        $ prof start 1
+//        Sample EIP only
+//        $ prof stop
+//        $ prof flat 20
+//        Top 20 functions by samples spent in the function itself
+//        $ prof graph
+//        Top functions by inclusive samples, with their callees
+int mon_prof(int argc, char **argv, struct Trapframe *tf) {
+  int n = (argc > 2) ? strtol(argv[2], 0, 0) : 0;
+
+  if (argc < 2) {
+    cprintf("Usage: prof start [depth] | stop | flat [N] | graph [N]\n");
+    return 1;
+  }
+  if (strcmp(argv[1], "start") == 0)
+    prof_start(n ? n : PROF_DEPTH);
+  else if (strcmp(argv[1], "stop") == 0)
+    prof_stop();
+  else if (strcmp(argv[1], "flat") == 0 || strcmp(argv[1], "graph") == 0)
+    prof_report(argv[1][0] == 'g', n ? n : 20);
+  else {
+    cprintf("Unknown prof command '%s'\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
+// Return to the env that trapped into the monitor (e.g. through a
+// breakpoint), so that e.g. a profile can be collected.
+int mon_continue(int argc, char **argv, struct Trapframe *tf) {
+  if (tf == NULL) {
+    cprintf("Nothing to continue\n");
+    return 0;
+  }
+  return -1;
+}
 
 int
 mon_help(int argc, char **argv, struct Trapframe *tf)
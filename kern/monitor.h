@@ -18,6 +18,9 @@ int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
 int mon_map(int argc, char **argv, struct Trapframe *tf);
 int mon_perm(int argc, char **argv, struct Trapframe *tf);
 int mon_dump(int argc, char **argv, struct Trapframe *tf);
+int mon_trace(int argc, char **argv, struct Trapframe *tf);
+int mon_prof(int argc, char **argv, struct Trapframe *tf);
+int mon_continue(int argc, char **argv, struct Trapframe *tf);
 int mon_v2p(int argc, char **argv, struct Trapframe *tf);
 
 
@@ -1,9 +1,11 @@
 /* See COPYRIGHT for copyright information. */
 
 #include <inc/assert.h>
+#include <inc/error.h>
 #include <inc/trap.h>
 
 #include <kern/picirq.h>
+#include <kern/env.h>
 
 
 // Current IRQ mask.
@@ -95,3 +97,56 @@ irq_eoi(void)
 	outb(IO_PIC1, 0x20);
 	outb(IO_PIC2, 0x20);
 }
+
+// User-mode device drivers (the file server's IDE driver) sleep on an
+// IRQ line with sys_irq_wait.  Each line has at most one waiter; an
+// interrupt that arrives while nobody waits is counted, so a driver
+// that starts a command and then waits cannot miss its completion.
+static struct {
+	envid_t waiter;		// Env blocked on this line, or 0
+	uint32_t pending;	// Interrupts nobody has waited for yet
+} irq_lines[MAX_IRQS];
+
+// Wait for an interrupt on 'irq' on behalf of 'e', unmasking the line
+// the first time anyone waits on it.  Returns 1 if an interrupt is
+// already pending (it is consumed), or 0 if 'e' was recorded as the
+// line's waiter and should block.  Returns -E_INVAL if another env
+// is already waiting on the line.
+int
+irq_wait(struct Env *e, int irq)
+{
+	struct Env *w;
+
+	assert(irq >= 0 && irq < MAX_IRQS);
+	if (irq_lines[irq].pending > 0) {
+		irq_lines[irq].pending--;
+		return 1;
+	}
+	if (irq_lines[irq].waiter && irq_lines[irq].waiter != e->env_id &&
+	    envid2env(irq_lines[irq].waiter, &w, 0) == 0 && w->env_irq_waiting)
+		return -E_INVAL;
+	if (irq_mask_8259A & (1<<irq))
+		irq_setmask_8259A(irq_mask_8259A & ~(1<<irq));
+	irq_lines[irq].waiter = e->env_id;
+	e->env_irq_waiting = 1;
+	return 0;
+}
+
+// Deliver an interrupt on 'irq': wake the env waiting for it, or
+// remember it for the next irq_wait.  Returns 1 if an env was woken.
+int
+irq_wakeup(int irq)
+{
+	struct Env *e;
+	envid_t envid = irq_lines[irq].waiter;
+
+	irq_lines[irq].waiter = 0;
+	if (envid == 0 || envid2env(envid, &e, 0) < 0 ||
+	    !e->env_irq_waiting || e->env_status != ENV_NOT_RUNNABLE) {
+		irq_lines[irq].pending++;
+		return 0;
+	}
+	e->env_irq_waiting = 0;
+	e->env_status = ENV_RUNNABLE;
+	return 1;
+}
@@ -24,6 +24,10 @@ extern uint16_t irq_mask_8259A;
 void pic_init(void);
 void irq_setmask_8259A(uint16_t mask);
 void irq_eoi(void);
+
+struct Env;
+int irq_wait(struct Env *e, int irq);
+int irq_wakeup(int irq);
 #endif // !__ASSEMBLER__
 
 #endif // !JOS_KERN_PICIRQ_H
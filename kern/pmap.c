@@ -174,6 +174,13 @@ mem_init(void)
 	envs = (struct Env*) boot_alloc(sizeof( struct Env) * NENV);
 	cprintf("envs %x\n", (uint32_t)envs);
 
+	// The envs[] image must leave room for the service registry
+	// page at USERVICES; lower LOG2NENV if this fires.
+	static_assert(sizeof(struct Env) * NENV <= USERVICES - UENVS);
+	static_assert(sizeof(struct EnvRegistry) <= PGSIZE);
+	env_registry = (struct EnvRegistry *) boot_alloc(PGSIZE);
+	memset(env_registry, 0, PGSIZE);
+
 
 	//////////////////////////////////////////////////////////////////////
 	// Now that we've allocated the initial kernel data structures, we set
@@ -229,6 +236,10 @@ mem_init(void)
                   PADDR(envs), 
                   (PTE_U | PTE_P));
   cprintf("UENVS 0x%x\n", UENVS);
+
+	// Map the service registry read-only by the user at USERVICES.
+	boot_map_region(kern_pgdir, USERVICES, PGSIZE,
+			PADDR(env_registry), PTE_U | PTE_P);
 	//////////////////////////////////////////////////////////////////////
 	// Use the physical memory that 'bootstack' refers to as the kernel
 	// stack.  The kernel stack grows down from virtual address KSTACKTOP.
@@ -437,6 +448,11 @@ page_alloc(int alloc_flags)
 {
 	// Fill this function in
   struct Page * pp = NULL;
+  int i;
+
+  // Out of memory: finish tearing down freed envs before giving up.
+  for (i = 0; i < ncpu && !page_free_list; i++)
+    env_reap(&cpus[i], -1);
   if (!page_free_list) return NULL;
   pp = page_free_list;
   //if (!pp) cprintf("pp is NULL\n");
@@ -444,7 +460,7 @@ page_alloc(int alloc_flags)
   //if (!page_free_list) cprintf("page_free_list is NULL\n");
   
   if (alloc_flags & ALLOC_ZERO)
-    memset(page2kva(pp), 0, PGSIZE);
+    pgzero(page2kva(pp));
   //cprintf("page_alloc: pa 0x%x\n", page2pa(pp));
 	return pp;
 }
@@ -612,6 +628,8 @@ page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm)
         
         *pte |= perm; // maybe wrong here, cannot clear a bit
         //pp->pp_ref++; //? and shall I change perm?
+        // Dropping PTE_W (e.g. for COW) must reach every TLB.
+        tlb_invalidate(pgdir, va);
         return 0;
       } else {
         page_remove(pgdir, va);
@@ -641,7 +659,8 @@ page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 {
 	// Fill this function in
   pte_t * pgtab = pgdir_walk(pgdir, va, 0);
-  if (pgtab) {
+  // Not-present PTEs may hold a demand-zero reservation, not a page.
+  if (pgtab && (*pgtab & PTE_P)) {
     if(pte_store) *pte_store = pgtab;
     return pa2page(PTE_ADDR(*pgtab));
   } else
@@ -677,8 +696,144 @@ page_remove(pde_t *pgdir, void *va)
 }
 
 //
-// Invalidate a TLB entry, but only if the page tables being
-// edited are the ones currently in use by the processor.
+// Like page_insert and page_remove, but on env 'e's address space,
+// keeping e's count of mapped user pages (env_stats.es_npages) in step.
+//
+int
+env_page_insert(struct Env *e, struct Page *pp, void *va, int perm)
+{
+	pte_t *pte = pgdir_walk(e->env_pgdir, va, 0);
+	bool mapped = pte && (*pte & PTE_P);
+	int r;
+
+	if ((r = page_insert(e->env_pgdir, pp, va, perm)) < 0)
+		return r;
+	if (!mapped)
+		e->env_stats.es_npages++;
+	return 0;
+}
+
+void
+env_page_remove(struct Env *e, void *va)
+{
+	pte_t *pte = pgdir_walk(e->env_pgdir, va, 0);
+
+	if (pte && (*pte & PTE_P)) {
+		page_remove(e->env_pgdir, va);
+		e->env_stats.es_npages--;
+	} else if (pte)
+		*pte = 0;	// drop any demand-zero reservation
+}
+
+// Pending TLB shootdown, collected between tlb_batch_begin and
+// tlb_batch_end.  Protected by the big kernel lock.
+static int tlb_batch_depth;
+static pde_t *tlb_batch_pgdir;
+static struct Page *tlb_batch_free;	// Linked by pp_link
+
+// Make every other CPU that may have 'pgdir' loaded flush its TLB,
+// and wait until the ones running user code have done so.
+//
+// The kernel lock makes this simple but needs care: a CPU spinning on
+// the lock has interrupts off and would never take our IPI.  So only
+// CPUs in user mode are sent an IPI and waited for; a CPU that has
+// entered the kernel calls tlb_shootdown_ack once it has the lock,
+// before it can touch user memory again.
+static void
+tlb_shootdown(pde_t *pgdir)
+{
+	struct Cpu *c;
+	uint32_t gen[NCPU];
+	bool wait[NCPU];
+	int i;
+
+	for (i = 0; i < ncpu; i++) {
+		c = &cpus[i];
+		wait[i] = 0;
+		if (c == thiscpu || !c->cpu_env || c->cpu_env->env_pgdir != pgdir)
+			continue;
+		// xchg orders the request before the cpu_in_user read,
+		// pairing with the xchg in trap().
+		gen[i] = c->cpu_tlb_req + 1;
+		xchg(&c->cpu_tlb_req, gen[i]);
+		if (c->cpu_in_user) {
+			lapic_ipi_dest(c->cpu_id, T_TLBFLUSH);
+			wait[i] = 1;
+		}
+	}
+	for (i = 0; i < ncpu; i++) {
+		c = &cpus[i];
+		while (wait[i] && c->cpu_in_user &&
+		       (int32_t) (c->cpu_tlb_done - gen[i]) < 0)
+			asm volatile("pause");
+	}
+}
+
+// Bring this CPU's TLB up to date with the shootdowns other CPUs
+// have requested of it.  Called from the T_TLBFLUSH handler and on
+// every entry to the kernel from user mode.
+void
+tlb_shootdown_ack(void)
+{
+	uint32_t gen = thiscpu->cpu_tlb_req;
+
+	if (thiscpu->cpu_tlb_done == gen)
+		return;
+	// Remote invalidations flush everything; one cr3 reload is
+	// cheaper than shipping a list of addresses to every CPU.
+	lcr3(rcr3());
+	thiscpu->cpu_tlb_done = gen;
+}
+
+// Defer remote TLB invalidations until the matching tlb_batch_end, so
+// an operation that changes many mappings sends each affected CPU at
+// most one IPI.  Batches nest.
+void
+tlb_batch_begin(void)
+{
+	tlb_batch_depth++;
+}
+
+void
+tlb_batch_end(void)
+{
+	struct Page *pp;
+
+	assert(tlb_batch_depth > 0);
+	if (--tlb_batch_depth > 0)
+		return;
+	if (tlb_batch_pgdir) {
+		tlb_shootdown(tlb_batch_pgdir);
+		tlb_batch_pgdir = NULL;
+	}
+	while ((pp = tlb_batch_free) != NULL) {
+		tlb_batch_free = pp->pp_link;
+		pp->pp_link = NULL;
+		page_free(pp);
+	}
+}
+
+// Drop a reference to 'pp', whose mapping was just invalidated with
+// tlb_invalidate.  Inside a batch, other CPUs may still reach pp
+// through a stale TLB entry until tlb_batch_end, so a page that would
+// be freed is only freed then.
+static void
+page_decref_unmapped(struct Page *pp)
+{
+	if (tlb_batch_depth == 0) {
+		page_decref(pp);
+		return;
+	}
+	if (--pp->pp_ref == 0) {
+		pp->pp_link = tlb_batch_free;
+		tlb_batch_free = pp;
+	}
+}
+
+//
+// Invalidate a TLB entry, on this CPU if the page tables being
+// edited are the ones currently in use by the processor, and on any
+// other CPU running an env with the same page tables.
 //
 void
 tlb_invalidate(pde_t *pgdir, void *va)
@@ -686,6 +841,304 @@ tlb_invalidate(pde_t *pgdir, void *va)
 	// Flush the entry only if we're modifying the current address space.
 	if (!curenv || curenv->env_pgdir == pgdir)
 		invlpg(va);
+
+	if (tlb_batch_depth == 0) {
+		tlb_shootdown(pgdir);
+		return;
+	}
+	// A batch only tracks one address space; flush out the old one
+	// if the caller moves on to another.
+	if (tlb_batch_pgdir && tlb_batch_pgdir != pgdir)
+		tlb_shootdown(tlb_batch_pgdir);
+	tlb_batch_pgdir = pgdir;
+}
+
+// Return the PTE for 'va' given 'prev', the PTE returned for
+// va - PGSIZE (or NULL).  Within a page table this just steps to the
+// next entry, so walking a range costs one pgdir_walk per page table
+// rather than one per page.
+static pte_t *
+range_walk(pde_t *pgdir, uintptr_t va, pte_t *prev, int create)
+{
+	if (prev && PTX(va) != 0)
+		return prev + 1;
+	return pgdir_walk(pgdir, (void *) va, create);
+}
+
+//
+// Map fresh zeroed pages with permission 'perm' over the page-aligned
+// range [va, va+len) of env e, replacing any pages already mapped
+// there.  On -E_NO_MEM the pages mapped so far stay mapped.
+//
+int
+env_page_alloc_range(struct Env *e, uintptr_t va, size_t len, int perm)
+{
+	uintptr_t end = va + len;
+	pte_t *pte = NULL, old;
+	struct Page *pp;
+	int r = 0;
+
+	tlb_batch_begin();
+	for (; va < end; va += PGSIZE) {
+		if (!(pte = range_walk(e->env_pgdir, va, pte, 1)) ||
+		    !(pp = page_alloc(ALLOC_ZERO))) {
+			r = -E_NO_MEM;
+			break;
+		}
+		old = *pte;
+		*pte = page2pa(pp) | perm | PTE_P;
+		pp->pp_ref++;
+		if (old & PTE_P) {
+			tlb_invalidate(e->env_pgdir, (void *) va);
+			page_decref_unmapped(pa2page(PTE_ADDR(old)));
+		} else
+			e->env_stats.es_npages++;
+	}
+	tlb_batch_end();
+	return r;
+}
+
+//
+// Unmap every page, and drop every demand-zero reservation, in the
+// page-aligned range [va, va+len) of env e.  Ranges without a page
+// table are skipped a page table at a time.
+//
+void
+env_page_unmap_range(struct Env *e, uintptr_t va, size_t len)
+{
+	uintptr_t end = va + len;
+	pte_t *pte = NULL, old;
+
+	tlb_batch_begin();
+	for (; va < end; va += PGSIZE) {
+		if (!(pte = range_walk(e->env_pgdir, va, pte, 0))) {
+			va = ROUNDDOWN(va, PTSIZE) + PTSIZE - PGSIZE;
+			continue;
+		}
+		if (!(*pte & PTE_P)) {
+			*pte = 0;	// drop any demand-zero reservation
+			continue;
+		}
+		old = *pte;
+		*pte = 0;
+		tlb_invalidate(e->env_pgdir, (void *) va);
+		page_decref_unmapped(pa2page(PTE_ADDR(old)));
+		e->env_stats.es_npages--;
+	}
+	tlb_batch_end();
+}
+
+//
+// Set the permission bits of every mapped or reserved page in the
+// page-aligned range [va, va+len) of env e to 'perm', clearing PTE_A
+// and PTE_D.  Unmapped pages are left alone.  Returns -E_INVAL, changing nothing,
+// if perm has PTE_W but some page in the range is read-only.
+//
+int
+env_page_protect_range(struct Env *e, uintptr_t va, size_t len, int perm)
+{
+	uintptr_t a, end = va + len;
+	pte_t *pte;
+
+	if (perm & PTE_W)
+		for (a = va, pte = NULL; a < end; a += PGSIZE) {
+			if (!(pte = range_walk(e->env_pgdir, a, pte, 0))) {
+				a = ROUNDDOWN(a, PTSIZE) + PTSIZE - PGSIZE;
+				continue;
+			}
+			if ((*pte & PTE_P) && !(*pte & PTE_W))
+				return -E_INVAL;
+		}
+
+	tlb_batch_begin();
+	for (a = va, pte = NULL; a < end; a += PGSIZE) {
+		if (!(pte = range_walk(e->env_pgdir, a, pte, 0))) {
+			a = ROUNDDOWN(a, PTSIZE) + PTSIZE - PGSIZE;
+			continue;
+		}
+		if (!(*pte & PTE_P)) {
+			if (*pte & PTE_LAZY)
+				*pte = (perm & ~PTE_P) | PTE_LAZY;
+			continue;
+		}
+		if ((*pte & 0xFFF) == (perm | PTE_P))
+			continue;
+		*pte = PTE_ADDR(*pte) | perm | PTE_P;
+		tlb_invalidate(e->env_pgdir, (void *) a);
+	}
+	tlb_batch_end();
+	return 0;
+}
+
+//
+// Reserve demand-zero pages with permission 'perm' over the
+// page-aligned range [va, va+len) of env e: no memory is allocated
+// until env_page_populate fills a page in on first touch.  Pages
+// already mapped in the range are left as they are.
+//
+int
+env_page_reserve_range(struct Env *e, uintptr_t va, size_t len, int perm)
+{
+	uintptr_t end = va + len;
+	pte_t *pte = NULL;
+
+	for (; va < end; va += PGSIZE) {
+		if (!(pte = range_walk(e->env_pgdir, va, pte, 1)))
+			return -E_NO_MEM;
+		if (!(*pte & PTE_P))
+			*pte = (perm & ~PTE_P) | PTE_LAZY;
+	}
+	return 0;
+}
+
+//
+// Fill in the demand-zero page reserved at 'va' in env e with a
+// zeroed page.  A not-present PTE is never cached in the TLB, so no
+// invalidation is needed.
+//
+// RETURNS:
+//   0 on success
+//   -E_INVAL if no demand-zero page is reserved at va
+//   -E_NO_MEM if out of memory
+//
+int
+env_page_populate(struct Env *e, uintptr_t va)
+{
+	pte_t *pte = pgdir_walk(e->env_pgdir, (void *) va, 0);
+	struct Page *pp;
+
+	if (!pte || (*pte & PTE_P) || !(*pte & PTE_LAZY))
+		return -E_INVAL;
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	*pte = page2pa(pp) | (*pte & PTE_SYSCALL & ~PTE_LAZY) | PTE_P;
+	pp->pp_ref++;
+	e->env_stats.es_npages++;
+	return 0;
+}
+
+//
+// Break copy-on-write sharing of the page at 'va' in env e after a
+// write fault: copy it into a fresh page mapped writable at 'va', or,
+// if e holds the only reference, just make it writable in place.
+//
+// RETURNS:
+//   0 on success
+//   -E_INVAL if no copy-on-write page is mapped at va
+//   -E_NO_MEM if out of memory
+//
+int
+env_page_cow(struct Env *e, uintptr_t va)
+{
+	pte_t *pte = pgdir_walk(e->env_pgdir, (void *) va, 0);
+	struct Page *pp, *np;
+	int perm;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if (!pte || !(*pte & PTE_P) || !(*pte & PTE_COW))
+		return -E_INVAL;
+	perm = (*pte & PTE_SYSCALL & ~PTE_COW) | PTE_W;
+	pp = pa2page(PTE_ADDR(*pte));
+	if (pp->pp_ref == 1) {
+		*pte = PTE_ADDR(*pte) | perm;
+		tlb_invalidate(e->env_pgdir, (void *) va);
+		return 0;
+	}
+	if (!(np = page_alloc(0)))
+		return -E_NO_MEM;
+	pgcopy(page2kva(np), page2kva(pp));
+	if (page_insert(e->env_pgdir, np, (void *) va, perm) < 0) {
+		page_free(np);
+		return -E_NO_MEM;
+	}
+	return 0;
+}
+
+//
+// Give env 'dst', whose address space must be empty, a copy-on-write
+// clone of env 'src''s address space below UTOP, as fork() would but
+// without a system call per page.  Writable and copy-on-write pages
+// become read-only PTE_COW in both envs; read-only and PTE_SHARE pages
+// are shared as they are; demand-zero reservations carry over.  The
+// user exception stack and the page holding src's saved %esp, both
+// written as soon as dst runs, get private copies up front.
+// On -E_NO_MEM the pages cloned so far stay mapped.
+//
+int
+env_page_clone(struct Env *dst, struct Env *src)
+{
+	uintptr_t va, sp = ROUNDDOWN(src->env_tf.tf_esp - 1, PGSIZE);
+	pte_t *spte = NULL, *dpte;
+	struct Page *pp;
+	int perm, r = 0;
+
+	tlb_batch_begin();
+	for (va = 0; va < UTOP; va += PGSIZE) {
+		if (!(spte = range_walk(src->env_pgdir, va, spte, 0))) {
+			va = ROUNDDOWN(va, PTSIZE) + PTSIZE - PGSIZE;
+			continue;
+		}
+		if (*spte == 0)
+			continue;
+		if (!(dpte = pgdir_walk(dst->env_pgdir, (void *) va, 1))) {
+			r = -E_NO_MEM;
+			break;
+		}
+		if (!(*spte & PTE_P)) {
+			*dpte = *spte;		// demand-zero reservation
+			continue;
+		}
+
+		perm = *spte & PTE_SYSCALL;
+		pp = pa2page(PTE_ADDR(*spte));
+		if ((va == UXSTACKTOP - PGSIZE || va == sp) && (perm & PTE_W)) {
+			if (!(pp = page_alloc(0))) {
+				r = -E_NO_MEM;
+				break;
+			}
+			pgcopy(page2kva(pp), page2kva(pa2page(PTE_ADDR(*spte))));
+		} else if ((perm & (PTE_W | PTE_COW)) && !(perm & PTE_SHARE)) {
+			perm = (perm & ~PTE_W) | PTE_COW;
+			if (*spte & PTE_W) {
+				*spte = PTE_ADDR(*spte) | perm;
+				tlb_invalidate(src->env_pgdir, (void *) va);
+			}
+		}
+		*dpte = page2pa(pp) | perm;
+		pp->pp_ref++;
+		dst->env_stats.es_npages++;
+	}
+	tlb_batch_end();
+	return r;
+}
+
+//
+// Handle a not-present fault at 'va' inside env e's fill region:
+// map a zeroed page there, and the same page at e->env_fill_va, so the
+// env's upcall can fill the page in through the alias.  Writes through
+// the alias don't set PTE_D in the PTE at va, so the page starts out
+// clean without another system call.
+//
+// RETURNS:
+//   0 on success, -E_NO_MEM if out of memory.
+//
+int
+env_page_fill(struct Env *e, uintptr_t va)
+{
+	struct Page *pp;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if (env_page_insert(e, pp, (void *) e->env_fill_va, PTE_U | PTE_W | PTE_P) < 0) {
+		page_free(pp);
+		return -E_NO_MEM;
+	}
+	if (env_page_insert(e, pp, (void *) va, PTE_U | PTE_W | PTE_P) < 0) {
+		env_page_remove(e, (void *) e->env_fill_va);
+		return -E_NO_MEM;
+	}
+	return 0;
 }
 
 static uintptr_t user_mem_check_addr;
@@ -723,7 +1176,11 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm)
       user_mem_check_addr = (i==0) ? (uint32_t)va : a;
       return -E_FAULT;
     }
+    // the kernel is about to touch it, so fill in a demand-zero page
+    if (!(*pte & PTE_P) && (*pte & PTE_LAZY))
+      env_page_populate(env, a);
     if ((a + PGSIZE > ULIM ) || 
+        !(*pte & PTE_P) ||
         (*pte & perm) != perm) {
       user_mem_check_addr = (i==0) ? (uint32_t)va : a;
       return -E_FAULT;
@@ -924,6 +1381,7 @@ check_kern_pgdir(void)
 	n = ROUNDUP(NENV*sizeof(struct Env), PGSIZE);
 	for (i = 0; i < n; i += PGSIZE)
 		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
+	assert(check_va2pa(pgdir, USERVICES) == PADDR(env_registry));
 
 	// check phys mem
 	for (i = 0; i < npages * PGSIZE; i += PGSIZE)
@@ -64,8 +64,21 @@ int	page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
 struct Page *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct Page *pp);
+int	env_page_insert(struct Env *e, struct Page *pp, void *va, int perm);
+void	env_page_remove(struct Env *e, void *va);
+int	env_page_alloc_range(struct Env *e, uintptr_t va, size_t len, int perm);
+void	env_page_unmap_range(struct Env *e, uintptr_t va, size_t len);
+int	env_page_protect_range(struct Env *e, uintptr_t va, size_t len, int perm);
+int	env_page_reserve_range(struct Env *e, uintptr_t va, size_t len, int perm);
+int	env_page_populate(struct Env *e, uintptr_t va);
+int	env_page_fill(struct Env *e, uintptr_t va);
+int	env_page_cow(struct Env *e, uintptr_t va);
+int	env_page_clone(struct Env *dst, struct Env *src);
 
 void	tlb_invalidate(pde_t *pgdir, void *va);
+void	tlb_batch_begin(void);
+void	tlb_batch_end(void);
+void	tlb_shootdown_ack(void);
 
 int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
 void	user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
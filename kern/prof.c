@@ -0,0 +1,281 @@
+// Timer-driven sampling profiler.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+#include <inc/trap.h>
+
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/kdebug.h>
+#include <kern/prof.h>
+
+struct ProfBuf {
+	uint32_t pb_n;			// Samples recorded
+	uint32_t pb_dropped;		// Samples lost because pb was full
+	struct ProfSample pb_samples[PROF_NSAMPLE];
+};
+
+static struct ProfBuf prof_bufs[NCPU];
+static bool prof_enabled;
+static int prof_depth = PROF_DEPTH;
+
+// Report-time aggregation tables.
+#define PROF_NFUNC	128
+#define PROF_NARC	256
+
+struct ProfFunc {
+	envid_t pf_env;			// Owning env; 0 for the kernel
+	uintptr_t pf_addr;		// Function start address
+	char pf_name[32];
+	uint32_t pf_self;		// Samples with this function on top
+	uint32_t pf_total;		// Samples with it anywhere on the stack
+};
+
+struct ProfArc {
+	int pa_caller, pa_callee;	// Indices into prof_funcs
+	uint32_t pa_count;
+};
+
+static struct ProfFunc prof_funcs[PROF_NFUNC];
+static struct ProfArc prof_arcs[PROF_NARC];
+static int prof_nfunc, prof_narc;
+
+// Record one sample for the interrupted context 'tf'.
+// Called from the timer interrupt on every CPU.
+void
+prof_sample(struct Trapframe *tf)
+{
+	struct ProfBuf *pb;
+	struct ProfSample *s;
+	uint32_t *ebp;
+	bool user = (tf->tf_cs & 3) == 3;
+	int n;
+
+	if (!prof_enabled)
+		return;
+	pb = &prof_bufs[cpunum()];
+	if (pb->pb_n == PROF_NSAMPLE) {
+		pb->pb_dropped++;
+		return;
+	}
+
+	s = &pb->pb_samples[pb->pb_n++];
+	s->ps_env = user ? curenv->env_id : 0;
+	s->ps_eip[0] = tf->tf_eip;
+
+	// Walk the %ebp chain like mon_backtrace does, but never trust a
+	// user frame pointer we haven't checked.
+	ebp = (uint32_t *) tf->tf_regs.reg_ebp;
+	for (n = 1; n < prof_depth && ebp; n++) {
+		if (user ? user_mem_check(curenv, ebp, 8, PTE_U) < 0
+			 : (uintptr_t) ebp < ULIM)
+			break;
+		s->ps_eip[n] = ebp[1];
+		ebp = (uint32_t *) ebp[0];
+	}
+	s->ps_depth = n;
+}
+
+// Discard old samples and start sampling up to 'depth' frames.
+void
+prof_start(int depth)
+{
+	int i;
+
+	if (depth < 1 || depth > PROF_DEPTH)
+		depth = PROF_DEPTH;
+	for (i = 0; i < NCPU; i++)
+		prof_bufs[i].pb_n = prof_bufs[i].pb_dropped = 0;
+	prof_depth = depth;
+	prof_enabled = 1;
+}
+
+void
+prof_stop(void)
+{
+	prof_enabled = 0;
+}
+
+// Find the function containing 'eip' in env 'envid' (0: kernel),
+// copy its name into 'name' and return its start address.  Functions
+// without STABS are named (and keyed) by the sampled address itself.
+// User STABS live in the env's own address space, so borrow it for
+// the duration of the lookup.
+static uintptr_t
+prof_lookup(envid_t envid, uintptr_t eip, char *name, int size)
+{
+	struct Eipdebuginfo info;
+	struct Env *e, *saved = NULL;
+	uint32_t cr3 = 0;
+	int r, len;
+
+	if (envid != 0) {
+		if (envid2env(envid, &e, 0) < 0) {
+			snprintf(name, size, "%08x", eip);
+			return eip;
+		}
+		saved = curenv;
+		cr3 = rcr3();
+		curenv = e;
+		lcr3(PADDR(e->env_pgdir));
+	}
+
+	r = debuginfo_eip(eip, &info);
+	if (r == 0) {
+		len = MIN(info.eip_fn_namelen, size - 1);
+		strncpy(name, info.eip_fn_name, len);
+		name[len] = '\0';
+	}
+
+	if (envid != 0) {
+		lcr3(cr3);
+		curenv = saved;
+	}
+
+	if (r < 0) {
+		snprintf(name, size, "%08x", eip);
+		return eip;
+	}
+	return info.eip_fn_addr;
+}
+
+// Return the prof_funcs index for the function containing 'eip',
+// adding it if needed; -1 if the table is full.
+static int
+prof_func(envid_t envid, uintptr_t eip)
+{
+	struct ProfFunc *f;
+	char name[sizeof(prof_funcs[0].pf_name)];
+	uintptr_t addr;
+	int i;
+
+	addr = prof_lookup(envid, eip, name, sizeof(name));
+	for (i = 0; i < prof_nfunc; i++)
+		if (prof_funcs[i].pf_env == envid &&
+		    prof_funcs[i].pf_addr == addr)
+			return i;
+	if (prof_nfunc == PROF_NFUNC)
+		return -1;
+
+	f = &prof_funcs[prof_nfunc];
+	f->pf_env = envid;
+	f->pf_addr = addr;
+	strcpy(f->pf_name, name);
+	f->pf_self = f->pf_total = 0;
+	return prof_nfunc++;
+}
+
+static void
+prof_arc(int caller, int callee)
+{
+	int i;
+
+	for (i = 0; i < prof_narc; i++)
+		if (prof_arcs[i].pa_caller == caller &&
+		    prof_arcs[i].pa_callee == callee) {
+			prof_arcs[i].pa_count++;
+			return;
+		}
+	if (prof_narc == PROF_NARC)
+		return;
+	prof_arcs[prof_narc].pa_caller = caller;
+	prof_arcs[prof_narc].pa_callee = callee;
+	prof_arcs[prof_narc].pa_count = 1;
+	prof_narc++;
+}
+
+// Fold all recorded samples into prof_funcs and prof_arcs.
+// Returns the number of samples folded.
+static uint32_t
+prof_fold(uint32_t *dropped)
+{
+	struct ProfSample *s;
+	int c, i, j, k, fn[PROF_DEPTH];
+	uint32_t nsamples = 0;
+	uintptr_t eip;
+
+	prof_nfunc = prof_narc = 0;
+	*dropped = 0;
+	for (c = 0; c < ncpu; c++) {
+		*dropped += prof_bufs[c].pb_dropped;
+		for (i = 0; i < prof_bufs[c].pb_n; i++) {
+			s = &prof_bufs[c].pb_samples[i];
+			nsamples++;
+			for (j = 0; j < s->ps_depth; j++) {
+				// Return addresses point after the call, which
+				// may be past the end of the caller.
+				eip = j ? s->ps_eip[j] - 1 : s->ps_eip[j];
+				fn[j] = prof_func(eip >= ULIM ? 0 : s->ps_env, eip);
+				if (fn[j] < 0)
+					break;
+				for (k = 0; k < j && fn[k] != fn[j]; k++)
+					;
+				if (k == j)
+					prof_funcs[fn[j]].pf_total++;
+				if (j == 0)
+					prof_funcs[fn[j]].pf_self++;
+				else
+					prof_arc(fn[j], fn[j-1]);
+			}
+		}
+	}
+	return nsamples;
+}
+
+static uint32_t
+prof_key(struct ProfFunc *f, bool graph)
+{
+	return graph ? f->pf_total : f->pf_self;
+}
+
+// Print the hottest 'count' functions by self samples, or with
+// 'graph' set, by total samples followed by the callees each of them
+// spent its samples in.
+void
+prof_report(bool graph, int count)
+{
+	struct ProfFunc *f;
+	uint32_t nsamples, dropped;
+	int i, j, best, order[PROF_NFUNC];
+
+	nsamples = prof_fold(&dropped);
+	cprintf("%u samples (%u dropped), %s\n", nsamples, dropped,
+		prof_enabled ? "running" : "stopped");
+	if (nsamples == 0)
+		return;
+
+	// Partial selection sort.  Arcs refer to functions by index,
+	// so sort a permutation instead of the table itself.
+	for (i = 0; i < prof_nfunc; i++)
+		order[i] = i;
+	for (i = 0; i < prof_nfunc && i < count; i++) {
+		best = i;
+		for (j = i + 1; j < prof_nfunc; j++)
+			if (prof_key(&prof_funcs[order[j]], graph) >
+			    prof_key(&prof_funcs[order[best]], graph))
+				best = j;
+		j = order[i];
+		order[i] = order[best];
+		order[best] = j;
+	}
+
+	cprintf("  self%%  total%%     self    total  env       function\n");
+	for (i = 0; i < prof_nfunc && i < count; i++) {
+		f = &prof_funcs[order[i]];
+		if (prof_key(f, graph) == 0)
+			break;
+		cprintf("  %5u  %6u  %7u  %7u  %08x  %s\n",
+			f->pf_self * 100 / nsamples, f->pf_total * 100 / nsamples,
+			f->pf_self, f->pf_total, f->pf_env, f->pf_name);
+		if (!graph)
+			continue;
+		for (j = 0; j < prof_narc; j++)
+			if (prof_arcs[j].pa_caller == order[i])
+				cprintf("%45s-> %7u  %s\n", "",
+					prof_arcs[j].pa_count,
+					prof_funcs[prof_arcs[j].pa_callee].pf_name);
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef JOS_KERN_PROF_H
+#define JOS_KERN_PROF_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+// Statistical profiler.
+// While enabled, every LAPIC timer interrupt records the interrupted
+// EIP, plus up to PROF_DEPTH-1 return addresses from the %ebp chain,
+// into a per-CPU sample buffer.  The 'prof' monitor command folds the
+// samples into per-function counts using the STABS (debuginfo_eip).
+
+#define PROF_DEPTH	4	// Max frames per sample, including EIP
+#define PROF_NSAMPLE	1024	// Samples per CPU
+
+struct ProfSample {
+	envid_t ps_env;			// Interrupted env; 0 for kernel mode
+	uint32_t ps_depth;		// Valid entries in ps_eip
+	uintptr_t ps_eip[PROF_DEPTH];	// EIP, then return addresses
+};
+
+struct Trapframe;
+
+void prof_sample(struct Trapframe *tf);
+void prof_start(int depth);
+void prof_stop(void);
+void prof_report(bool graph, int count);
+
+#endif	// !JOS_KERN_PROF_H
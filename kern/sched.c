@@ -1,88 +1,188 @@
 #include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/error.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/sched.h>
 
+// How far (in weighted TSC cycles) an env that slept may fall behind
+// the fair-class clock.  Without the clamp, an env that blocked on IPC
+// for a long time would come back with a tiny vruntime and monopolize
+// the CPU until it caught up with everyone else.
+#define SCHED_WAKEUP_SLACK	20000000ULL
 
-// Choose a user environment to run and run it.
+// Page tables of freed envs torn down on each pass through the
+// scheduler; whatever is left is torn down when the CPU goes idle.
+#define SCHED_REAP_BATCH	4
+
+// Lower bound of the vruntime of every runnable fair env.
+// Only moves forward; protected by the big kernel lock.
+static uint64_t sched_min_vruntime;
+
+// Give a freshly allocated env the default scheduling parameters.
+// It starts at the current fair-class clock, so it neither waits for
+// nor jumps ahead of the envs that are already running.
 void
-sched_yield(void)
+sched_env_init(struct Env *e)
+{
+	e->env_sched_class = ENV_SCHED_FAIR;
+	e->env_weight = ENV_WEIGHT_DEFAULT;
+	e->env_vruntime = sched_min_vruntime;
+	e->env_run_start = 0;
+}
+
+// Charge e for the cycles it ran in user mode since env_run
+// dispatched it.  Called on every entry into the kernel from e.
+void
+sched_charge(struct Env *e)
+{
+	uint64_t now, delta;
+
+	if (e->env_run_start == 0)
+		return;
+	now = read_tsc();
+	delta = now - e->env_run_start;
+	e->env_run_start = 0;
+	e->env_stats.es_cycles += delta;
+	if (e->env_sched_class == ENV_SCHED_FAIR)
+		e->env_vruntime += delta * ENV_WEIGHT_DEFAULT / e->env_weight;
+}
+
+// Set the scheduling class and weight of e.
+// Returns 0 on success, -E_INVAL if either argument is out of range.
+int
+sched_set_priority(struct Env *e, int sched_class, int weight)
+{
+	if (sched_class < 0 || sched_class >= ENV_SCHED_NCLASS)
+		return -E_INVAL;
+	if (weight < ENV_WEIGHT_MIN || weight > ENV_WEIGHT_MAX)
+		return -E_INVAL;
+	e->env_sched_class = sched_class;
+	e->env_weight = weight;
+	return 0;
+}
+
+// Choose a user environment to run and run it.  With 'preempt' set,
+// the env this CPU was running has not given up the CPU, so it
+// competes with the runnable envs instead of only running when
+// nothing else can.
+static void __attribute__((noreturn))
+sched_pick(bool preempt)
 {
-	struct Env *idle;
-	int i;
-    uint32_t ei, ei_beg; // env number begin at
+	struct Env *idle, *e, *sys, *cursys, *fair;
+	uint32_t n;
+	uint64_t floor;
 
-	// Implement simple round-robin scheduling.
+	// Two scheduling classes, see inc/env.h:
 	// case 1:
-	// Search through 'envs' for an ENV_RUNNABLE environment in
-	// circular fashion starting just after the env this CPU was
-	// last running.  Switch to the first such environment found.
+	// Search through the allocated envs in circular fashion starting
+	// just after the env this CPU was last running.  The first
+	// ENV_RUNNABLE system-class env found wins outright, so the fs
+	// and ns servers are never queued behind CPU-bound user envs.
+	// When preempting, a system-class env still ENV_RUNNING on this
+	// CPU keeps it unless another system-class env is runnable; the
+	// circular search takes turns among those.
 	// case 2:
+	// Otherwise run the ENV_RUNNABLE fair-class env with the smallest
+	// vruntime; ties go to the first one in circular order.  When
+	// preempting, the env still ENV_RUNNING on this CPU is a
+	// candidate too, and wins ties, so a heavy env keeps the CPU
+	// for as long as it is owed time.
+	// case 3:
 	// If no envs are runnable, but the environment previously
 	// running on this CPU is still ENV_RUNNING, it's okay to
 	// choose that environment.
-	// case 3:
+	// case 4:
 	// Never choose an environment that's currently running on
 	// another CPU (env_status == ENV_RUNNING) and never choose an
 	// idle environment (env_type == ENV_TYPE_IDLE).  If there are
 	// no runnable environments, simply drop through to the code
 	// below to switch to this CPU's idle environment.
+	//
+	// Only env_live_list is walked, so the cost grows with the
+	// number of allocated envs, not with NENV.
 
-	// LAB 4: Your code here.
-
-    ei_beg = (thiscpu->cpu_env) ? ENVX(thiscpu->cpu_env->env_id) : 0;
-    ei_beg++;
-    ei_beg = ei_beg % NENV;
-    //cprintf("cpu env begin %x\n", (uint32_t)ei_beg);
-    
-    // case 1: RUNNABLE
-	for (i = 0; i < NENV; i++) {
-      ei = (ei_beg + i) % NENV;
-      if (envs[ei].env_type != ENV_TYPE_IDLE &&
-          envs[ei].env_status == ENV_RUNNABLE) {
-        /* 
-         * cprintf("cpu[%d] pick runnable envs[%d]\n", 
-         *         cpunum(), ei, envs[ei].env_type, envs[ei].env_status);
-         */
-        env_run(&envs[ei]);
-        break;
-      }
-	}
-    
-    // debug: print how many envs is running
-    //print_envs(0);
-
-    // case 2: RUNNING
-	for (i = 0; i < NENV; i++) {
-      ei = (ei_beg + i) % NENV;
-      if (envs[ei].env_type != ENV_TYPE_IDLE &&
-          envs[ei].env_status == ENV_RUNNING &&
-          envs[ei].env_cpunum == cpunum()
-          ) {
-        /* 
-         * cprintf("cpu[%d] pick running envs[%d]\n", 
-         *         cpunum(), ei, envs[ei].env_type, envs[ei].env_status);
-         */
-        env_run(&envs[ei]);
-        break;
-      }
+	env_reap(thiscpu, SCHED_REAP_BATCH);
+
+	floor = sched_min_vruntime > SCHED_WAKEUP_SLACK ?
+		sched_min_vruntime - SCHED_WAKEUP_SLACK : 0;
+	sys = cursys = fair = NULL;
+
+	// case 1, 2: a preempted env competes with the others in its class
+	e = thiscpu->cpu_env;
+	if (preempt && e && e->env_type != ENV_TYPE_IDLE &&
+	    e->env_status == ENV_RUNNING && e->env_cpunum == cpunum()) {
+		if (e->env_sched_class == ENV_SCHED_SYSTEM)
+			cursys = e;
+		else {
+			if (e->env_vruntime < floor)
+				e->env_vruntime = floor;
+			fair = e;
+		}
 	}
 
+	e = thiscpu->cpu_env;
+	if (e && e->env_status != ENV_FREE)
+		e = LIST_NEXT(e, env_live_link);
+	else
+		e = NULL;
+
+	// case 1, 2: RUNNABLE
+	for (n = 0; n < env_nlive; n++, e = LIST_NEXT(e, env_live_link)) {
+		if (!e)
+			e = LIST_FIRST(&env_live_list);
+		if (e->env_type == ENV_TYPE_IDLE ||
+		    e->env_status != ENV_RUNNABLE)
+			continue;
+		if (e->env_sched_class == ENV_SCHED_SYSTEM) {
+			sys = e;
+			break;
+		}
+		if (e->env_vruntime < floor)
+			e->env_vruntime = floor;
+		if (!fair || e->env_vruntime < fair->env_vruntime)
+			fair = e;
+	}
 
-	// For debugging and testing purposes, if there are no
-	// runnable environments other than the idle environments,
-	// drop into the kernel monitor.
-	if (i == NENV) {
-      //cprintf("cpu[%d] No more runnable/running environments!\n", cpunum());
-		//while (1)
-		//	monitor(NULL);
+	if (sys)
+		env_run(sys);
+	if (cursys)
+		env_run(cursys);
+	if (fair) {
+		if (fair->env_vruntime > sched_min_vruntime)
+			sched_min_vruntime = fair->env_vruntime;
+		env_run(fair);
 	}
 
-	// Run this CPU's idle environment when nothing else is runnable.
-    //cprintf("cpu[%d] run idle\n", cpunum());
+	// case 3: RUNNING
+	e = thiscpu->cpu_env;
+	if (e && e->env_type != ENV_TYPE_IDLE &&
+	    e->env_status == ENV_RUNNING && e->env_cpunum == cpunum())
+		env_run(e);
+
+	// Run this CPU's idle environment when nothing else is runnable,
+	// after finishing any deferred teardown.
+	env_reap(thiscpu, -1);
 	idle = &envs[cpunum()];
 	if (!(idle->env_status == ENV_RUNNABLE || idle->env_status == ENV_RUNNING))
 		panic("CPU %d: No idle environment!", cpunum());
 	env_run(idle);
 }
+
+// Give up the CPU: run the env this CPU was running again only if
+// nothing else is runnable.
+void
+sched_yield(void)
+{
+	sched_pick(0);
+}
+
+// Called when an interrupt takes the CPU from the running env: pick
+// whichever env is owed the CPU most, which may be the same one.
+void
+sched_preempt(void)
+{
+	sched_pick(1);
+}
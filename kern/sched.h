@@ -6,7 +6,14 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
-// This function does not return.
+struct Env;
+
+// These functions do not return.
 void sched_yield(void) __attribute__((noreturn));
+void sched_preempt(void) __attribute__((noreturn));
+
+void sched_env_init(struct Env *e);
+void sched_charge(struct Env *e);
+int sched_set_priority(struct Env *e, int sched_class, int weight);
 
 #endif	// !JOS_KERN_SCHED_H
@@ -4,6 +4,7 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/elf.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
@@ -13,6 +14,9 @@
 #include <kern/sched.h>
 #include <kern/time.h>
 #include <kern/pci.h>
+#include <kern/picirq.h>
+#include <kern/ide.h>
+#include <kern/trace.h>
 
 
 #define debug 0
@@ -29,7 +33,21 @@ sys_cputs(const char *s, size_t len)
   user_mem_assert(curenv, s, len, PTE_P | PTE_U);
 
 	// Print the string supplied by the user.
-	cprintf("%.*s", len, s);
+	cons_write(s, len);
+}
+
+// Read the kernel log, like dmesg.  Copies up to 'len' bytes of
+// console output, starting at log position *pos, into 'buf'.  Output
+// that has already dropped out of the log is skipped.  Advances *pos
+// past the bytes copied and returns how many were copied; 0 means the
+// reader has caught up.
+// Destroys the environment if 'buf' or 'pos' is not writable.
+static int
+sys_klog_read(char *buf, size_t len, uint32_t *pos)
+{
+	user_mem_assert(curenv, buf, len, PTE_U | PTE_W);
+	user_mem_assert(curenv, pos, sizeof(*pos), PTE_U | PTE_W);
+	return klog_read(buf, len, pos);
 }
 
 // Read a character from the system console without blocking.
@@ -40,6 +58,25 @@ sys_cgetc(void)
 	return cons_getc();
 }
 
+// Read a character from the system console, blocking until there is
+// one.  A blocked env is woken by the keyboard or serial interrupt
+// that delivers its character.
+// Returns the character, or 0 if the caller should try again (it was
+// woken some other way, or too many envs are already waiting).
+static int
+sys_cgetc_wait(void)
+{
+	int c;
+
+	if ((c = cons_getc()) != 0)
+		return c;
+	if (cons_wait(curenv) < 0)
+		return 0;
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
 // Returns the current environment's envid.
 static envid_t
 sys_getenvid(void)
@@ -130,6 +167,9 @@ sys_env_set_status(envid_t envid, int status)
       status != ENV_NOT_RUNNABLE)
     return -E_INVAL;
   if (envid2env(envid, &env, 1) == 0) {
+    // A snapshot never runs again; see sys_env_snapshot.
+    if (env->env_snapshot == ENV_SNAP_FROZEN)
+      return -E_INVAL;
     env->env_status = status;
     //cprintf("env[%x] set status to %x\n", env->env_id, env->env_status);
     return 0;
@@ -171,6 +211,52 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
   return 0;
 }
 
+// Set the scheduling class and weight of 'envid'.
+// 'sched_class' is ENV_SCHED_FAIR or ENV_SCHED_SYSTEM and 'weight' is
+// the env's share of the CPU within the fair class (see inc/env.h).
+// Only an env that is already in the system class may put an env
+// into it, so user envs can't starve the servers.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if sched_class or weight is out of range, or the caller
+//		may not grant ENV_SCHED_SYSTEM.
+static int
+sys_env_set_priority(envid_t envid, int sched_class, int weight)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = envid2env(envid, &env, 1)) < 0)
+		return r;
+	if (sched_class == ENV_SCHED_SYSTEM &&
+	    curenv->env_sched_class != ENV_SCHED_SYSTEM)
+		return -E_INVAL;
+	return sched_set_priority(env, sched_class, weight);
+}
+
+// Register the calling env in the service registry at USERVICES under
+// the 'len'-byte name 'name', so that clients can find it with
+// ipc_find_service.  The entry goes away when the env is freed.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if the name is empty, SERVICE_NAMELEN bytes or longer,
+//		or already registered by another env.
+//	-E_NO_MEM if the registry is full.
+static int
+sys_env_register(const char *name, size_t len)
+{
+	char buf[SERVICE_NAMELEN];
+
+	if (len == 0 || len >= SERVICE_NAMELEN)
+		return -E_INVAL;
+	user_mem_assert(curenv, name, len, PTE_U);
+	memmove(buf, name, len);
+	buf[len] = '\0';
+	return env_register(curenv, buf);
+}
+
 // Set the page fault upcall for 'envid' by modifying the corresponding struct
 // Env's 'env_pgfault_upcall' field.  When 'envid' causes a page fault, the
 // kernel will push a fault record onto the exception stack, then branch to
@@ -241,7 +327,7 @@ sys_page_alloc(envid_t envid, void *va, int perm)
     return -E_BAD_ENV;
   if ((pg = page_alloc(ALLOC_ZERO)) == NULL)
     return -E_NO_MEM;
-  if ((r = page_insert(env->env_pgdir, pg, va, perm)) != 0) {
+  if ((r = env_page_insert(env, pg, va, perm)) != 0) {
     page_free(pg);
     return -E_NO_MEM;
   }
@@ -307,6 +393,9 @@ sys_page_map(envid_t srcenvid, void *srcva,
     return -E_INVAL;
   }
 
+  // sharing a demand-zero page needs a real one
+  if (env_page_populate(srcenv, (uintptr_t)srcva) == -E_NO_MEM)
+    return -E_NO_MEM;
   if((pg = page_lookup(srcenv->env_pgdir, srcva, &srcpte)) == NULL) {
     cprintf("sys_page_map: E_INVAl case 3\n");
     return -E_INVAL;
@@ -322,7 +411,7 @@ sys_page_map(envid_t srcenvid, void *srcva,
    *         srcenv->env_id, dstenv->env_id, page2pa(pg), pg->pp_ref);
    */
 
-  if ((r = page_insert(dstenv->env_pgdir, pg, dstva, perm)) != 0) {
+  if ((r = env_page_insert(dstenv, pg, dstva, perm)) != 0) {
     return -E_NO_MEM;
   }
 
@@ -356,14 +445,164 @@ sys_page_unmap(envid_t envid, void *va)
   if ((r = envid2env(envid, &env, 1)) != 0)
     return -E_BAD_ENV;
   
-  page_remove(env->env_pgdir, va);
+  env_page_remove(env, va);
   
   return 0;
 }
 
+// Check that [va, va+len) is a page-aligned range below UTOP, and
+// return len rounded up to whole pages in *npbytes.
+static int
+range_check(void *va, size_t len, size_t *npbytes)
+{
+	uintptr_t start = (uintptr_t) va;
+
+	if (start % PGSIZE != 0 || start >= UTOP || len > UTOP - start)
+		return -E_INVAL;
+	*npbytes = ROUNDUP(len, PGSIZE);
+	return 0;
+}
+
+// Like sys_page_alloc, but for every page in [va, va+len), in a single
+// walk of the page table.  'len' is rounded up to a multiple of PGSIZE.
+// If memory runs out part way, the pages allocated so far stay mapped.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va is not page-aligned or the range reaches past UTOP.
+//	-E_INVAL if perm is inappropriate (see sys_page_alloc).
+//	-E_NO_MEM if there's no memory to allocate the new pages,
+//		or to allocate any necessary page tables.
+static int
+sys_page_alloc_range(envid_t envid, void *va, size_t len, int perm)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = range_check(va, len, &len)) < 0)
+		return r;
+	if ((perm & PTE_U) == 0 || (perm & PTE_P) == 0 ||
+	    (perm & ~PTE_SYSCALL) != 0)
+		return -E_INVAL;
+	if ((r = envid2env(envid, &env, 1)) < 0)
+		return r;
+	return env_page_alloc_range(env, (uintptr_t) va, len, perm);
+}
+
+// Like sys_page_unmap, but for every page in [va, va+len).
+// 'len' is rounded up to a multiple of PGSIZE.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va is not page-aligned or the range reaches past UTOP.
+static int
+sys_page_unmap_range(envid_t envid, void *va, size_t len)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = range_check(va, len, &len)) < 0)
+		return r;
+	if ((r = envid2env(envid, &env, 1)) < 0)
+		return r;
+	env_page_unmap_range(env, (uintptr_t) va, len);
+	return 0;
+}
+
+// Set the permissions of every mapped page in [va, va+len) to 'perm',
+// which also clears their accessed and dirty bits.  Unmapped pages are
+// skipped.  'len' is rounded up to a multiple of PGSIZE.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va is not page-aligned or the range reaches past UTOP.
+//	-E_INVAL if perm is inappropriate (see sys_page_alloc).
+//	-E_INVAL if (perm & PTE_W), but a page in the range is read-only.
+static int
+sys_page_protect(envid_t envid, void *va, size_t len, int perm)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = range_check(va, len, &len)) < 0)
+		return r;
+	if ((perm & PTE_U) == 0 || (perm & PTE_P) == 0 ||
+	    (perm & ~PTE_SYSCALL) != 0)
+		return -E_INVAL;
+	if ((r = envid2env(envid, &env, 1)) < 0)
+		return r;
+	return env_page_protect_range(env, (uintptr_t) va, len, perm);
+}
+
+// Reserve demand-zero pages with permission 'perm' over [va, va+len)
+// in the address space of 'envid'.  No memory is used until a page is
+// first touched; the page fault handler then maps a zeroed page in.
+// Pages already mapped in the range are left alone, so a whole heap
+// or bss can be reserved around pages that are in use.  'len' is
+// rounded up to a multiple of PGSIZE.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va is not page-aligned or the range reaches past UTOP.
+//	-E_INVAL if perm is inappropriate (see sys_page_alloc).
+//	-E_NO_MEM if there's no memory to allocate page tables.
+static int
+sys_page_reserve(envid_t envid, void *va, size_t len, int perm)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = range_check(va, len, &len)) < 0)
+		return r;
+	if ((perm & PTE_U) == 0 || (perm & PTE_P) == 0 ||
+	    (perm & ~PTE_SYSCALL) != 0)
+		return -E_INVAL;
+	if ((r = envid2env(envid, &env, 1)) < 0)
+		return r;
+	return env_page_reserve_range(env, (uintptr_t) va, len, perm);
+}
+
+// Register [va, va+len) as envid's fill region.  A not-present page
+// fault in the region no longer leaves the upcall to allocate a page:
+// the kernel first maps a zeroed page at the faulting page, and the
+// same page at 'fillva', through which the upcall can fill it in
+// (e.g. from disk) without making the page dirty at its real address.
+// Both mappings are PTE_U|PTE_W|PTE_P; the alias at fillva is replaced
+// on the next fill.  A 'len' of 0 removes the region.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va or fillva is not page-aligned, the region reaches
+//		past UTOP, fillva >= UTOP, or fillva is inside the region.
+static int
+sys_env_set_fault_fill(envid_t envid, void *va, size_t len, void *fillva)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = range_check(va, len, &len)) < 0)
+		return r;
+	if ((uintptr_t) fillva % PGSIZE != 0 || (uintptr_t) fillva >= UTOP ||
+	    ((uintptr_t) fillva >= (uintptr_t) va &&
+	     (uintptr_t) fillva - (uintptr_t) va < len))
+		return -E_INVAL;
+	if ((r = envid2env(envid, &env, 1)) < 0)
+		return r;
+	env->env_fill_start = (uintptr_t) va;
+	env->env_fill_end = (uintptr_t) va + len;
+	env->env_fill_va = (uintptr_t) fillva;
+	return 0;
+}
+
 // Try to send 'value' to the target env 'envid'.
-// If srcva < UTOP, then also send page currently mapped at 'srcva',
-// so that receiver gets a duplicate mapping of the same page.
+// If srcva < UTOP, then also send the 'npages' pages currently mapped
+// at 'srcva', so that receiver gets duplicate mappings of the same
+// pages.  The receiver gets as many of them as it asked for, at most.
 //
 // The send fails with a return value of -E_IPC_NOT_RECV if the
 // target is not blocked, waiting for an IPC.
@@ -376,6 +615,7 @@ sys_page_unmap(envid_t envid, void *va)
 //    env_ipc_from is set to the sending envid;
 //    env_ipc_value is set to the 'value' parameter;
 //    env_ipc_perm is set to 'perm' if a page was transferred, 0 otherwise.
+//    env_ipc_npages is set to the number of pages transferred.
 // The target environment is marked runnable again, returning 0
 // from the paused sys_ipc_recv system call.  (Hint: does the
 // sys_ipc_recv function ever actually return?)
@@ -390,23 +630,26 @@ sys_page_unmap(envid_t envid, void *va)
 //		(No need to check permissions.)
 //	-E_IPC_NOT_RECV if envid is not currently blocked in sys_ipc_recv,
 //		or another environment managed to send first.
-//	o-E_INVAL if srcva < UTOP but srcva is not page-aligned.
+//	o-E_INVAL if srcva < UTOP but srcva is not page-aligned, 'npages'
+//		is 0, or the pages reach past UTOP.
 //	o-E_INVAL if srcva < UTOP and perm is inappropriate
 //		(see sys_page_alloc).
-//	o-E_INVAL if srcva < UTOP but srcva is not mapped in the caller's
-//		address space.
-//	o-E_INVAL if (perm & PTE_W), but srcva is read-only in the
+//	o-E_INVAL if srcva < UTOP but a page to send is not mapped in the
+//		caller's address space.
+//	o-E_INVAL if (perm & PTE_W), but a page to send is read-only in the
 //		current environment's address space.
-//	o-E_NO_MEM if there's not enough memory to map srcva in envid's
+//	o-E_NO_MEM if there's not enough memory to map the pages in envid's
 //		address space.
 static int
-sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+                 size_t npages)
 {
   // LAB 4: Your code here.
-  struct Env *srcenv, *dstenv;
+  struct Env *dstenv;
   struct Page * pg;
   pte_t *srcpte;
-  int r;
+  size_t i, n = 0;
+  void *va;
 
   if (envid2env(envid, &dstenv, 0) != 0)
     return -E_BAD_ENV;    
@@ -416,46 +659,55 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 
   //cprintf("[%x]sys_ipc_try_send start send\n", curenv->env_id);
 
-  dstenv->env_ipc_recving = 0;
-  dstenv->env_ipc_from = curenv->env_id;
-  dstenv->env_ipc_value = value;
-
-  // shared page IPC
+  // shared page IPC: check every page before mapping any
   if((uint32_t)srcva < UTOP) { 
-    if ((uint32_t)srcva%PGSIZE!=0) 
+    if ((uint32_t)srcva%PGSIZE!=0 || npages == 0 ||
+        npages > (UTOP - (uint32_t)srcva) / PGSIZE) 
       return -E_INVAL;
     
-  
     // shall I check PTE_COW and PTE_W are mutually exclusive
     if ((perm & PTE_U) == 0 ||
         (perm & PTE_P) == 0 ||
         (perm & ~PTE_SYSCALL) != 0)
       return -E_INVAL;
 
-    if((pg = page_lookup(curenv->env_pgdir, srcva, &srcpte)) == NULL) {
-      cprintf("sys_ipc_try_send: E_INVAl case 3\n");
-      return -E_INVAL;
-    }
+    if ((uint32_t)dstenv->env_ipc_dstva < UTOP)
+      n = MIN(npages, dstenv->env_ipc_dstnpages);
+    for (i = 0, va = srcva; i < n; i++, va += PGSIZE) {
+      if (env_page_populate(curenv, (uintptr_t)va) == -E_NO_MEM)
+        return -E_NO_MEM;
+      if((pg = page_lookup(curenv->env_pgdir, va, &srcpte)) == NULL) {
+        cprintf("sys_ipc_try_send: E_INVAl case 3\n");
+        return -E_INVAL;
+      }
 
-    if((perm & PTE_W) != 0 && (*srcpte & PTE_W) == 0) {
-      cprintf("sys_ipc_try_send: E_INVAl case 4\n");
-      return -E_INVAL;
+      if((perm & PTE_W) != 0 && (*srcpte & PTE_W) == 0) {
+        cprintf("sys_ipc_try_send: E_INVAl case 4\n");
+        return -E_INVAL;
+      }
     }
   
-    // what va shall I insert to dstenv
-    if ((r = page_insert(dstenv->env_pgdir, pg, dstenv->env_ipc_dstva, perm)) != 0) {
-      return -E_NO_MEM;
+    for (i = 0, va = srcva; i < n; i++, va += PGSIZE) {
+      pg = page_lookup(curenv->env_pgdir, va, NULL);
+      if (env_page_insert(dstenv, pg, dstenv->env_ipc_dstva + i * PGSIZE,
+                          perm) != 0)
+        return -E_NO_MEM;
     }
-    
-    // set IPC in dstenv
-    dstenv->env_ipc_perm = perm;
-  } else {
-    // only transmit data
-    dstenv->env_ipc_perm = 0;
   }
 
+  dstenv->env_ipc_recving = 0;
+  dstenv->env_ipc_from = curenv->env_id;
+  dstenv->env_ipc_value = value;
+  // set IPC in dstenv
+  dstenv->env_ipc_perm = n ? perm : 0;
+  dstenv->env_ipc_npages = n;
+
   dstenv->env_status = ENV_RUNNABLE;
   // shall I call sched_yield here?
+  curenv->env_stats.es_ipc_sent++;
+  dstenv->env_stats.es_ipc_recv++;
+  TRACE(TRACE_IPC_SEND, 0, envid, value, (uint32_t)srcva,
+        dstenv->env_ipc_perm, 0);
 
   if (debug && dstenv->env_ipc_value != 0 && 
       dstenv->env_ipc_value != E_UNSPECIFIED)
@@ -468,30 +720,33 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
 //
-// If 'dstva' is < UTOP, then you are willing to receive a page of data.
-// 'dstva' is the virtual address at which the sent page should be mapped.
+// If 'dstva' is < UTOP, then you are willing to receive up to 'npages'
+// pages of data.  'dstva' is the virtual address at which the first
+// sent page should be mapped; the others follow it.
 //
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
-//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned, 'npages'
+//		is 0, or the pages reach past UTOP.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, size_t npages)
 {
   // LAB 4: Your code here.
-  curenv->env_ipc_recving = 1;
-  if ((uint32_t)dstva < UTOP) {
-    if ((uint32_t)dstva%PGSIZE==0)
-      curenv->env_ipc_dstva = dstva;
-    else {
-      if(debug)
-        cprintf("sys_ipc_recv: dstva%PGSIZE != 0\n");
-      return -E_INVAL;
-    }
+  if ((uint32_t)dstva < UTOP &&
+      ((uint32_t)dstva%PGSIZE != 0 || npages == 0 ||
+       npages > (UTOP - (uint32_t)dstva) / PGSIZE)) {
+    if(debug)
+      cprintf("sys_ipc_recv: bad dstva %08x npages %d\n", dstva, npages);
+    return -E_INVAL;
   }
+  curenv->env_ipc_recving = 1;
+  curenv->env_ipc_dstva = dstva;
+  curenv->env_ipc_dstnpages = npages;
 
   curenv->env_tf.tf_regs.reg_eax = 0; //recv return 0
   curenv->env_status = ENV_NOT_RUNNABLE;
+  TRACE(TRACE_IPC_RECV, 0, (uint32_t)dstva, 0, 0, 0, 0);
   //cprintf("[%x]sys_ipc_recv wait\n", curenv->env_id);
   sched_yield();
   /* 
@@ -500,6 +755,220 @@ sys_ipc_recv(void *dstva)
    */
 }
 
+// Map one loadable segment 'ph' of the ELF image at 'binary' in the
+// caller's address space into 'env'.  Whole pages of read-only segments
+// that the image has page aligned are shared with the caller; the rest
+// is copied into fresh pages, and any bss past the file data is
+// reserved demand-zero.
+static int
+env_load_segment(struct Env *env, const uint8_t *binary, struct Proghdr *ph)
+{
+	uintptr_t va, start, end, fend;
+	const uint8_t *src;
+	struct Page *pp;
+	bool share;
+	int r, perm;
+
+	perm = PTE_U | PTE_P;
+	if (ph->p_flags & ELF_PROG_FLAG_WRITE)
+		perm |= PTE_W;
+	share = !(perm & PTE_W) && PGOFF(binary) == 0 &&
+		PGOFF(ph->p_offset) == PGOFF(ph->p_va);
+
+	fend = ROUNDUP(ph->p_va + ph->p_filesz, PGSIZE);
+	for (va = ROUNDDOWN(ph->p_va, PGSIZE); va < fend; va += PGSIZE) {
+		// Share the page unless zeroes must follow the file data in it.
+		src = binary + ph->p_offset - (ph->p_va - va);
+		if (share && (va + PGSIZE <= ph->p_va + ph->p_filesz ||
+			      ph->p_memsz == ph->p_filesz) &&
+		    (pp = page_lookup(curenv->env_pgdir, (void *) src, NULL))) {
+			if ((r = env_page_insert(env, pp, (void *) va, perm)) < 0)
+				return r;
+			continue;
+		}
+
+		if (!(pp = page_alloc(ALLOC_ZERO)))
+			return -E_NO_MEM;
+		start = MAX(va, ph->p_va);
+		end = MIN(va + PGSIZE, ph->p_va + ph->p_filesz);
+		memmove(page2kva(pp) + (start - va),
+			binary + ph->p_offset + (start - ph->p_va), end - start);
+		if ((r = env_page_insert(env, pp, (void *) va, perm)) < 0) {
+			page_free(pp);
+			return r;
+		}
+	}
+
+	end = ROUNDUP(ph->p_va + ph->p_memsz, PGSIZE);
+	if (fend < end)
+		return env_page_reserve_range(env, fend, end - fend, perm);
+	return 0;
+}
+
+// Load the loadable segments of the ELF executable at [binary,
+// binary+size) in the caller's address space into envid, typically a
+// child fresh from sys_exofork, in one go.  Read-only pages are mapped
+// rather than copied, so if the caller mapped the file from the file
+// server's cache (see fmap), every env running the program shares one
+// copy of its text.  The caller still sets up the stack and entry point.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if envid is the caller, the image is not mapped in the
+//		caller's address space, or a segment lies outside the image
+//		or reaches past UTOP.
+//	-E_NOT_EXEC if the image is not an ELF executable.
+//	-E_NO_MEM if there's no memory for the pages or page tables.
+static int
+sys_env_load(envid_t envid, const void *binary, size_t size)
+{
+	const struct Elf *elf = binary;
+	struct Proghdr *ph;
+	struct Env *env;
+	int i, r;
+
+	if ((r = envid2env(envid, &env, 1)) < 0)
+		return r;
+	if (env == curenv || (uintptr_t) binary >= UTOP ||
+	    user_mem_check(curenv, binary, size, PTE_U) < 0)
+		return -E_INVAL;
+	if (size < sizeof(struct Elf) || elf->e_magic != ELF_MAGIC ||
+	    elf->e_phoff > size ||
+	    elf->e_phnum > (size - elf->e_phoff) / sizeof(struct Proghdr))
+		return -E_NOT_EXEC;
+
+	ph = (struct Proghdr *) (binary + elf->e_phoff);
+	for (i = 0; i < elf->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD)
+			continue;
+		if (ph->p_filesz > ph->p_memsz || ph->p_offset > size ||
+		    ph->p_filesz > size - ph->p_offset ||
+		    ph->p_va > UTOP || ph->p_memsz > UTOP - ph->p_va)
+			return -E_INVAL;
+		if ((r = env_load_segment(env, binary, ph)) < 0)
+			return r;
+	}
+	return 0;
+}
+
+// Make envid a snapshot: a frozen, fully initialized image of a
+// program that sys_env_clone instantiates new envs from.  An env
+// freezes itself by passing 0 (or its own envid), and the call then
+// returns only in its clones, as 0.  Any other envid, typically a
+// child that spawn has yet to start, is just marked ENV_SNAP_PENDING:
+// libmain freezes it once it has initialized, right before umain.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if envid already is a snapshot.
+static int
+sys_env_snapshot(envid_t envid)
+{
+	struct Env *env;
+	int r;
+
+	if ((r = envid2env(envid, &env, 1)) < 0)
+		return r;
+	if (env->env_snapshot == ENV_SNAP_FROZEN)
+		return -E_INVAL;
+	if (env != curenv) {
+		env->env_snapshot = ENV_SNAP_PENDING;
+		return 0;
+	}
+
+	env->env_snapshot = ENV_SNAP_FROZEN;
+	env->env_status = ENV_NOT_RUNNABLE;
+	env->env_tf.tf_regs.reg_eax = 0;
+	sched_yield();
+}
+
+// Create a new env from the snapshot snapid (see sys_env_snapshot).
+// Its address space is a copy-on-write clone of the snapshot's, so
+// there is no ELF image to load or memory to zero, and it resumes where
+// the snapshot froze, with the same registers, FPU state and page fault
+// upcall.  Like a sys_exofork child it is the caller's child and starts
+// out ENV_NOT_RUNNABLE.
+//
+// Returns envid of new environment, or < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment snapid doesn't currently exist,
+//		or the caller doesn't have permission to change snapid.
+//	-E_INVAL if snapid is not a frozen snapshot.
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_env_clone(envid_t snapid)
+{
+	struct Env *snap, *env;
+	int r;
+
+	if ((r = envid2env(snapid, &snap, 1)) < 0)
+		return r;
+	if (snap->env_snapshot != ENV_SNAP_FROZEN)
+		return -E_INVAL;
+	if ((r = env_alloc(&env, curenv->env_id)) < 0)
+		return r;
+	if ((r = env_page_clone(env, snap)) < 0) {
+		env_free(env);
+		return r;
+	}
+
+	env->env_tf = snap->env_tf;
+	env->env_fpu = snap->env_fpu;
+	env->env_pgfault_upcall = snap->env_pgfault_upcall;
+	env->env_fill_start = snap->env_fill_start;
+	env->env_fill_end = snap->env_fill_end;
+	env->env_fill_va = snap->env_fill_va;
+	env->env_status = ENV_NOT_RUNNABLE;
+	return env->env_id;
+}
+
+// Block until device interrupt 'irq' fires.  Only envs with I/O
+// privilege (the file server) drive devices, so only they may wait,
+// and only the IDE line is routed to user-mode drivers.
+// An interrupt that fired since the last wait is returned right away;
+// the caller must still check its device, since a wakeup can be for
+// an earlier command.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if irq is not a line user drivers can wait on, or another
+//		env is already waiting on it.
+//	-E_BAD_ENV if the caller does not have I/O privilege.
+static int
+sys_irq_wait(int irq)
+{
+	int r;
+
+	if (irq != IRQ_IDE)
+		return -E_INVAL;
+	if ((curenv->env_tf.tf_eflags & FL_IOPL_MASK) != FL_IOPL_3)
+		return -E_BAD_ENV;
+	if ((r = irq_wait(curenv, irq)) != 0)
+		return r < 0 ? r : 0;
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Set up a bus-master DMA transfer between the disk and the caller's
+// [va, va+len), to the disk if 'todisk' is set (see ide_dma_prepare).
+// Only envs with I/O privilege may drive the disk.
+//
+// Returns the bus master's I/O base port on success, < 0 on error.
+// Errors are:
+//	-E_BAD_ENV if the caller does not have I/O privilege.
+//	-E_NOT_SUPP if there is no bus master IDE controller.
+//	-E_INVAL if the buffer is unaligned, too large or not mapped
+//		with the needed permissions.
+static int
+sys_ide_dma(void *va, size_t len, bool todisk)
+{
+	if ((curenv->env_tf.tf_eflags & FL_IOPL_MASK) != FL_IOPL_3)
+		return -E_BAD_ENV;
+	return ide_dma_prepare(curenv, va, len, todisk);
+}
+
 // Return the current time.
 static int
 sys_time_msec(void)
@@ -558,6 +1027,8 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	// Return any appropriate return value.
 	// LAB 3: Your code here.
   //cprintf("syscall %d\n", syscallno);
+  if (syscallno < NSYSCALLS)
+    curenv->env_stats.es_syscalls[syscallno]++;
   switch (syscallno) {
   case SYS_cputs:
     //cprintf("%s", (char*) tf->tf_regs.reg_edx); 
@@ -597,13 +1068,41 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
     return sys_env_set_trapframe(a1, (void*)a2);
     break;
   case SYS_ipc_try_send:
-    return sys_ipc_try_send(a1, a2, (void*)a3, a4);
+    return sys_ipc_try_send(a1, a2, (void*)a3, a4, a5);
   case SYS_ipc_recv:
-    return sys_ipc_recv((void*)a1);
+    return sys_ipc_recv((void*)a1, a2);
   case SYS_time_msec:
     return sys_time_msec();
   case SYS_pci_send_pkt:
     return sys_pci_send_pkt(a1, (void*)a2, a3);
+  case SYS_env_set_priority:
+    return sys_env_set_priority(a1, a2, a3);
+  case SYS_env_register:
+    return sys_env_register((const char*)a1, a2);
+  case SYS_page_alloc_range:
+    return sys_page_alloc_range(a1, (void*)a2, a3, a4);
+  case SYS_page_unmap_range:
+    return sys_page_unmap_range(a1, (void*)a2, a3);
+  case SYS_page_protect:
+    return sys_page_protect(a1, (void*)a2, a3, a4);
+  case SYS_page_reserve:
+    return sys_page_reserve(a1, (void*)a2, a3, a4);
+  case SYS_env_set_fault_fill:
+    return sys_env_set_fault_fill(a1, (void*)a2, a3, (void*)a4);
+  case SYS_klog_read:
+    return sys_klog_read((char*)a1, a2, (uint32_t*)a3);
+  case SYS_cgetc_wait:
+    return sys_cgetc_wait();
+  case SYS_env_load:
+    return sys_env_load(a1, (const void*)a2, a3);
+  case SYS_env_snapshot:
+    return sys_env_snapshot(a1);
+  case SYS_env_clone:
+    return sys_env_clone(a1);
+  case SYS_irq_wait:
+    return sys_irq_wait(a1);
+  case SYS_ide_dma:
+    return sys_ide_dma((void *) a1, a2, a3);
   default:
     cprintf("Error syscall:\n");
     break;
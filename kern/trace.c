@@ -0,0 +1,163 @@
+// Per-CPU binary event trace rings.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/trace.h>
+
+struct TraceRing {
+	uint32_t tr_head;	// Total records ever written to this ring
+	struct TraceRec tr_recs[TRACE_NREC];
+};
+
+static struct TraceRing trace_rings[NCPU];
+
+uint32_t trace_mask = TRACE_ALL;
+
+static const char * const trace_names[TRACE_NTYPES] = {
+	[TRACE_SWITCH]		= "switch",
+	[TRACE_SYSCALL]		= "syscall",
+	[TRACE_PGFAULT]		= "pgfault",
+	[TRACE_IPC_SEND]	= "send",
+	[TRACE_IPC_RECV]	= "recv",
+	[TRACE_IRQ]		= "irq",
+};
+
+// Append a record to this CPU's ring, overwriting the oldest one.
+// The kernel runs with interrupts off, so nothing else can write this
+// ring while we do; readers on other CPUs may see a half-written
+// record, which is fine for a debugging aid.
+void
+trace_event(int type, uint64_t start, uint32_t a0, uint32_t a1,
+	    uint32_t a2, uint32_t a3, uint32_t a4)
+{
+	struct TraceRing *ring = &trace_rings[cpunum()];
+	uint32_t pos = ring->tr_head;
+	struct TraceRec *r = &ring->tr_recs[pos & (TRACE_NREC - 1)];
+	uint64_t now = read_tsc();
+
+	r->tr_tsc = start ? start : now;
+	r->tr_dur = start ? (uint32_t) (now - start) : 0;
+	r->tr_env = curenv ? curenv->env_id : 0;
+	r->tr_type = type;
+	r->tr_arg[0] = a0;
+	r->tr_arg[1] = a1;
+	r->tr_arg[2] = a2;
+	r->tr_arg[3] = a3;
+	r->tr_arg[4] = a4;
+	ring->tr_head = pos + 1;
+}
+
+// Discard everything recorded so far on all CPUs.
+void
+trace_clear(void)
+{
+	int i;
+
+	for (i = 0; i < NCPU; i++)
+		trace_rings[i].tr_head = 0;
+}
+
+// Map an event type name to its TRACE_* value; -1 if unknown.
+int
+trace_type(const char *name)
+{
+	int i;
+
+	for (i = 1; i < TRACE_NTYPES; i++)
+		if (strcmp(name, trace_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+static bool
+trace_match(struct TraceRec *r, uint32_t mask, envid_t env)
+{
+	return (mask & TRACE_BIT(r->tr_type)) && (!env || r->tr_env == env);
+}
+
+static void
+trace_print(int cpu, struct TraceRec *r, uint64_t base)
+{
+	uint32_t *a = r->tr_arg;
+
+	cprintf("%12llu cpu%d %08x %-7s ", r->tr_tsc - base, cpu,
+		r->tr_env, trace_names[r->tr_type]);
+	switch (r->tr_type) {
+	case TRACE_SWITCH:
+		cprintf("-> %08x\n", a[0]);
+		break;
+	case TRACE_SYSCALL:
+		cprintf("%d(%x, %x, %x) = %d  [%u cycles]\n",
+			a[0], a[1], a[2], a[3], a[4], r->tr_dur);
+		break;
+	case TRACE_PGFAULT:
+		cprintf("va %08x eip %08x err %x\n", a[0], a[1], a[2]);
+		break;
+	case TRACE_IPC_SEND:
+		cprintf("to %08x value %x va %08x perm %x\n",
+			a[0], a[1], a[2], a[3]);
+		break;
+	case TRACE_IPC_RECV:
+		cprintf("dstva %08x\n", a[0]);
+		break;
+	case TRACE_IRQ:
+		cprintf("%d eip %08x\n", a[0], a[1]);
+		break;
+	default:
+		cprintf("?\n");
+	}
+}
+
+// Print the last 'count' records that match 'mask' and 'env' (0 for
+// any env), from CPU 'cpu' or from all CPUs if 'cpu' < 0.  Records
+// from different CPUs are merged by timestamp.
+void
+trace_dump(int cpu, uint32_t mask, envid_t env, int count)
+{
+	uint32_t pos[NCPU], end[NCPU];
+	struct TraceRec *r, *best;
+	uint64_t base = 0;
+	int c, bestc, pass, total = 0, skip = 0;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (c = 0; c < ncpu; c++) {
+			end[c] = trace_rings[c].tr_head;
+			pos[c] = end[c] > TRACE_NREC ? end[c] - TRACE_NREC : 0;
+			if (cpu >= 0 && c != cpu)
+				pos[c] = end[c];
+		}
+
+		if (pass == 1)
+			skip = total > count ? total - count : 0;
+		total = 0;
+		while (1) {
+			best = NULL;
+			bestc = -1;
+			for (c = 0; c < ncpu; c++) {
+				if (pos[c] == end[c])
+					continue;
+				r = &trace_rings[c].tr_recs[pos[c] & (TRACE_NREC - 1)];
+				if (!best || r->tr_tsc < best->tr_tsc) {
+					best = r;
+					bestc = c;
+				}
+			}
+			if (!best)
+				break;
+			pos[bestc]++;
+			if (!trace_match(best, mask, env))
+				continue;
+			total++;
+			if (pass == 0 || total <= skip)
+				continue;
+			if (!base)
+				base = best->tr_tsc;
+			trace_print(bestc, best, base);
+		}
+	}
+}
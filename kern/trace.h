@@ -0,0 +1,57 @@
+#ifndef JOS_KERN_TRACE_H
+#define JOS_KERN_TRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+// Kernel event tracing.
+// Each CPU owns a ring of fixed-size binary records that only it
+// writes, so recording needs no locks and no cprintf.  The 'trace'
+// monitor command merges the rings by timestamp and prints them.
+
+// Event types
+enum {
+	TRACE_SWITCH = 1,	// a0 = envid switched to
+	TRACE_SYSCALL,		// a0 = syscallno, a1..a3 = args, a4 = return
+	TRACE_PGFAULT,		// a0 = fault va, a1 = eip, a2 = error code
+	TRACE_IPC_SEND,		// a0 = dst envid, a1 = value, a2 = srcva, a3 = perm
+	TRACE_IPC_RECV,		// a0 = dstva
+	TRACE_IRQ,		// a0 = irq, a1 = interrupted eip
+	TRACE_NTYPES
+};
+
+#define TRACE_BIT(type)		(1 << (type))
+#define TRACE_ALL		(TRACE_BIT(TRACE_NTYPES) - 2)
+
+// Records per CPU; must be a power of 2.
+#define TRACE_NREC		512
+
+struct TraceRec {
+	uint64_t tr_tsc;	// TSC when the event started
+	uint32_t tr_dur;	// TSC cycles the event took (0 if instant)
+	envid_t tr_env;		// curenv when the event was recorded
+	uint32_t tr_type;	// TRACE_*
+	uint32_t tr_arg[5];	// Event specific, see above
+};
+
+// Event types currently being recorded (mask of TRACE_BIT()s).
+extern uint32_t trace_mask;
+
+void trace_event(int type, uint64_t start, uint32_t a0, uint32_t a1,
+		 uint32_t a2, uint32_t a3, uint32_t a4);
+void trace_clear(void);
+void trace_dump(int cpu, uint32_t mask, envid_t env, int count);
+int trace_type(const char *name);
+
+// Record an event of 'type' if tracing it is enabled.
+// 'start' is the TSC at which the event began, or 0 for an instant event.
+#define TRACE(type, start, a0, a1, a2, a3, a4)				\
+	do {								\
+		if (trace_mask & TRACE_BIT(type))			\
+			trace_event(type, start, a0, a1, a2, a3, a4);	\
+	} while (0)
+
+#endif	// !JOS_KERN_TRACE_H
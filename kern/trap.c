@@ -15,6 +15,10 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
+#include <kern/trace.h>
+#include <kern/prof.h>
+#include <kern/fpu.h>
+#include <kern/ide.h>
 
 static struct Taskstate ts;
 
@@ -186,6 +190,12 @@ print_regs(struct PushRegs *regs)
 static void
 trap_dispatch(struct Trapframe *tf)
 {
+  uint32_t syscallno;
+  uint64_t start;
+
+  if (tf->tf_trapno >= IRQ_OFFSET && tf->tf_trapno < IRQ_OFFSET + 16)
+    TRACE(TRACE_IRQ, 0, tf->tf_trapno - IRQ_OFFSET, tf->tf_eip, 0, 0, 0);
+
 	// Handle processor exceptions.
 	// LAB 3: Your code here.
   switch(tf->tf_trapno) {
@@ -196,12 +206,18 @@ trap_dispatch(struct Trapframe *tf)
     monitor(tf);
     break;
   case T_SYSCALL:
-    tf->tf_regs.reg_eax = syscall(tf->tf_regs.reg_eax,
+    // Syscalls that deschedule the caller (sys_yield, a blocking
+    // sys_ipc_recv) never get here and show up as a switch instead.
+    syscallno = tf->tf_regs.reg_eax;
+    start = read_tsc();
+    tf->tf_regs.reg_eax = syscall(syscallno,
                                   tf->tf_regs.reg_edx,
                                   tf->tf_regs.reg_ecx,
                                   tf->tf_regs.reg_ebx,
                                   tf->tf_regs.reg_edi,
                                   tf->tf_regs.reg_esi);
+    TRACE(TRACE_SYSCALL, start, syscallno, tf->tf_regs.reg_edx,
+          tf->tf_regs.reg_ecx, tf->tf_regs.reg_ebx, tf->tf_regs.reg_eax);
     break;
 	// Handle clock interrupts. Don't forget to acknowledge the
 	// interrupt using lapic_eoi() before calling the scheduler!
@@ -215,22 +231,26 @@ trap_dispatch(struct Trapframe *tf)
   case (IRQ_OFFSET + IRQ_TIMER):
     //cprintf("irq 0\n");
     time_tick();
+    cons_tick();
+    prof_sample(tf);
     lapic_eoi();
-    sched_yield();
+    sched_preempt();
 
     //print_trapframe(tf);
     return;
   case (IRQ_OFFSET + IRQ_KBD):
-    cprintf("irq 1\n");
-    print_trapframe(tf);
+    kbd_intr();
     return;
   case (IRQ_OFFSET + IRQ_SERIAL):
-    cprintf("irq 4\n");
-    print_trapframe(tf);
+    serial_intr();
     return;
   case (IRQ_OFFSET + IRQ_IDE):
-    cprintf("irq 14\n");
-    print_trapframe(tf);
+    // The file server's driver acknowledges the drive itself.  Run it
+    // right away so the disk does not sit idle until the next tick.
+    ide_dma_intr();
+    irq_eoi();
+    if (irq_wakeup(IRQ_IDE))
+      sched_preempt();
     return;
   case (IRQ_OFFSET + IRQ_ERROR):
     cprintf("irq 19\n");
@@ -275,13 +295,25 @@ trap(struct Trapframe *tf)
 	// the interrupt path.
 	assert(!(read_eflags() & FL_IF));
 
+	// The CPU that sent a shootdown IPI holds the kernel lock while
+	// it waits for us, so handle it without taking the lock.
+	if (tf->tf_trapno == T_TLBFLUSH) {
+		tlb_shootdown_ack();
+		lapic_eoi();
+		env_pop_tf(tf);
+	}
+
 	if ((tf->tf_cs & 3) == 3) {
 		// Trapped from user mode.
 		// Acquire the big kernel lock before doing any
 		// serious kernel work.
 		// LAB 4: Your code here.
+      xchg(&thiscpu->cpu_in_user, 0);
       lock_kernel();
+      tlb_shootdown_ack();
       assert(curenv);
+      fpu_save(curenv);
+      sched_charge(curenv);
 
 		// Garbage collect if current enviroment is a zombie
 		if (curenv->env_status == ENV_DYING) {
@@ -326,6 +358,7 @@ page_fault_handler(struct Trapframe *tf)
 
 	// Read processor's CR2 register to find the faulting address
 	fault_va = rcr2();
+	TRACE(TRACE_PGFAULT, 0, fault_va, tf->tf_eip, tf->tf_err, 0, 0);
 
 	// Handle kernel-mode page faults.
   
@@ -337,6 +370,37 @@ page_fault_handler(struct Trapframe *tf)
 
 	// We've already handled kernel-mode exceptions, so if we get here,
 	// the page fault happened in user mode.
+  pte_t *pte = pgdir_walk(curenv->env_pgdir, (void*)fault_va, 0);
+  curenv->env_stats.es_pgfaults++;
+  if ((tf->tf_err & FEC_WR) && pte && (*pte & PTE_P) && (*pte & PTE_COW)) {
+    curenv->env_stats.es_cowfaults++;
+    // Break copy-on-write sharing (see fork and sys_env_clone) here,
+    // so a cloned env needs no pgfault upcall of its own.
+    if (env_page_cow(curenv, fault_va) == 0)
+      return;
+    cprintf("[%08x] out of memory for copy-on-write page va %08x\n",
+            curenv->env_id, fault_va);
+    env_destroy(curenv);
+    return;
+  }
+
+  // Demand-zero pages (see sys_page_reserve) are filled in here; the
+  // env never sees the fault.
+  if (!(tf->tf_err & FEC_PR) && pte && (*pte & PTE_LAZY)) {
+    if (env_page_populate(curenv, fault_va) == 0)
+      return;
+    cprintf("[%08x] out of memory for demand-zero page va %08x\n",
+            curenv->env_id, fault_va);
+    env_destroy(curenv);
+    return;
+  }
+
+  // In the env's fill region, hand the upcall a fresh page to fill in
+  // instead of leaving it to allocate and remap one itself.  If that
+  // fails, the upcall still runs and can fall back to doing so.
+  if (!(tf->tf_err & FEC_PR) &&
+      fault_va >= curenv->env_fill_start && fault_va < curenv->env_fill_end)
+    env_page_fill(curenv, fault_va);
   //user_mem_assert(curenv, (void*)fault_va, 1, PTE_P | PTE_U);
 
 
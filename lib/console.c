@@ -16,8 +16,9 @@ int
 getchar(void)
 {
 	int r;
-	// sys_cgetc does not block, but getchar should.
-	while ((r = sys_cgetc()) == 0)
+
+	// Sleeps in the kernel until a key arrives; 0 means try again.
+	while ((r = sys_cgetc_wait()) == 0)
 		sys_yield();
 	return r;
 }
@@ -4,6 +4,8 @@
 
 #define debug 0
 
+static int fsipc_pages(unsigned type, void *dstva, size_t *npages);
+
 union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 
 // Send an inter-environment request to the file server, and wait for
@@ -14,6 +16,16 @@ union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 // Returns result from the file server.
 static int
 fsipc(unsigned type, void *dstva)
+{
+	size_t npages = 1;
+
+	return fsipc_pages(type, dstva, &npages);
+}
+
+// Like fsipc, but receive up to *npages reply pages at dstva, and
+// store the number received in *npages.
+static int
+fsipc_pages(unsigned type, void *dstva, size_t *npages)
 {
 	static envid_t fsenv;
     int r;
@@ -26,7 +38,7 @@ fsipc(unsigned type, void *dstva)
 		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
 
 	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
-	r = ipc_recv(NULL, dstva, NULL); 
+	r = ipc_recv_pages(NULL, dstva, npages, NULL); 
     //dstva returns from serve_open fd
     //cprintf("ipc_recv %e\n", r);
     return r;
@@ -205,6 +217,31 @@ remove(const char *path)
 	return fsipc(FSREQ_REMOVE, NULL);
 }
 
+// Map up to 'npages' pages of the file open on 'fdnum', starting at
+// 'offset' (which must be page aligned), read-only at 'dstva'.  The
+// pages are the file server's own cached copies, so they are shared
+// rather than copied, and they change if the file is written.
+// Returns the number of pages mapped, which may be fewer than asked
+// for, or < 0 on error (-E_INVAL if 'fdnum' is not a file or 'offset'
+// is out of range).
+int
+fmap(int fdnum, off_t offset, size_t npages, void *dstva)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	fsipcbuf.map.req_fileid = fd->fd_file.id;
+	fsipcbuf.map.req_offset = offset;
+	fsipcbuf.map.req_npages = npages;
+	if ((r = fsipc_pages(FSREQ_MAP, dstva, &npages)) < 0)
+		return r;
+	return npages;
+}
+
 // Synchronize disk with buffer cache
 int
 sync(void)
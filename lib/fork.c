@@ -50,7 +50,7 @@ pgfault(struct UTrapframe *utf)
     if ((r = sys_page_alloc(0, (void*)PFTEMP, PTE_URW)) < 0)
       panic("sys_page_alloc: %e", r);
 
-	memmove((void*)PFTEMP, va_beg, PGSIZE);
+	pgcopy((void*)PFTEMP, va_beg);
 
 	if ((r = sys_page_map(0, (void*)PFTEMP, 0, va_beg, PTE_URW)) < 0)
       panic("sys_page_map: %e", r);
@@ -110,6 +110,11 @@ duppage(envid_t envid, unsigned pn)
         if ((r = sys_page_map(0, (void*)va, envid, (void*)va, PGOFF(vpt[pn]))) < 0)
           panic("sys_page_map: %e", r);
       }
+    } else if (vpt[pn] & PTE_LAZY) {
+      // not touched yet: the child gets its own demand-zero page
+      if ((r = sys_page_reserve(envid, (void*)va, PGSIZE,
+                                (PGOFF(vpt[pn]) & PTE_SYSCALL & ~PTE_LAZY) | PTE_P)) < 0)
+        panic("sys_page_reserve: %e", r);
     }
 	return 0;
 }
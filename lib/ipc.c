@@ -80,15 +80,63 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
   } while (r != 0);
 }
 
+// Like ipc_recv, but willing to receive up to *npages pages, mapped
+// one after another from 'pg'.  Stores the number of pages actually
+// received in *npages.
+int32_t
+ipc_recv_pages(envid_t *from_env_store, void *pg, size_t *npages,
+	       int *perm_store)
+{
+	int r;
+
+	r = sys_ipc_recv_pages(pg ? pg : (void *) UTOP, pg ? *npages : 1);
+	if (from_env_store)
+		*from_env_store = r == 0 ? thisenv->env_ipc_from : 0;
+	if (perm_store)
+		*perm_store = r == 0 && pg ? thisenv->env_ipc_perm : 0;
+	if (pg)
+		*npages = r == 0 ? thisenv->env_ipc_npages : 0;
+	return r == 0 ? thisenv->env_ipc_value : r;
+}
+
+// Like ipc_send, but send the 'npages' pages starting at 'pg'.
+void
+ipc_send_pages(envid_t to_env, uint32_t val, void *pg, size_t npages,
+	       int perm)
+{
+	int r;
+
+	while ((r = sys_ipc_try_send_pages(to_env, val, pg ? pg : (void *) UTOP,
+					   npages, perm)) != 0) {
+		if (r != -E_IPC_NOT_RECV)
+			panic("ipc_send_pages: %e", r);
+		sys_yield();
+	}
+}
+
 // Find the first environment of the given type.  We'll use this to
-// find special environments.
+// find special environments.  The kernel publishes them in the
+// service registry, so this is a single load.
 // Returns 0 if no such environment exists.
 envid_t
 ipc_find_env(enum EnvType type)
+{
+	if (type < 0 || type >= ENV_NTYPES)
+		return 0;
+	return services.reg_bytype[type];
+}
+
+// Find the environment that registered itself as 'name' with
+// sys_env_register.
+// Returns 0 if no such environment exists.
+envid_t
+ipc_find_service(const char *name)
 {
 	int i;
-	for (i = 0; i < NENV; i++)
-		if (envs[i].env_type == type)
-			return envs[i].env_id;
+
+	for (i = 0; i < NSERVICE; i++)
+		if (strncmp((const char *) services.reg_names[i].sv_name,
+			    name, SERVICE_NAMELEN) == 0)
+			return services.reg_names[i].sv_envid;
 	return 0;
 }
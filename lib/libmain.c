@@ -11,6 +11,8 @@ const char *binaryname = "<unknown>";
 void
 libmain(int argc, char **argv)
 {
+	string_init();
+
 	// set thisenv to point at our Env structure in envs[].
 	// LAB 3: Your code here.
   //cprintf("u)envs 0x%x\n", envs);
@@ -20,6 +22,13 @@ libmain(int argc, char **argv)
 	if (argc > 0)
 		binaryname = argv[0];
 
+	// Freeze here if our parent wants a snapshot of us (see
+	// spawn_snapshot); each clone of the snapshot resumes here.
+	if (thisenv->env_snapshot == ENV_SNAP_PENDING) {
+		sys_env_snapshot(0);
+		thisenv = &envs[ENVX(sys_getenvid())];
+	}
+
 	// call user main routine
 	umain(argc, argv);
 
@@ -0,0 +1,77 @@
+// LZ4 block decompression.
+
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/lz4.h>
+
+// Read an LZ4 length extension: bytes of 255 continue it.
+// Returns -1 if it runs past 'end'.
+static ssize_t
+lz4_length(const uint8_t **ip, const uint8_t *end, size_t len)
+{
+	unsigned b;
+
+	do {
+		if (*ip == end)
+			return -1;
+		b = *(*ip)++;
+		len += b;
+	} while (b == 255);
+	return len;
+}
+
+// Expand the LZ4 block of 'srclen' bytes at 'src' into at most
+// 'dstlen' bytes at 'dst'.
+// Returns the number of bytes written, or -E_INVAL if the block is
+// corrupt or does not fit in 'dst'.
+int
+lz4_decompress(const void *src, size_t srclen, void *dst, size_t dstlen)
+{
+	const uint8_t *ip = src, *iend = ip + srclen, *match;
+	uint8_t *op = dst, *oend = op + dstlen;
+	unsigned token, off;
+	ssize_t len;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		// Literals
+		len = token >> 4;
+		if (len == 15 && (len = lz4_length(&ip, iend, len)) < 0)
+			return -E_INVAL;
+		if (len > iend - ip || len > oend - op)
+			return -E_INVAL;
+		memmove(op, ip, len);
+		op += len;
+		ip += len;
+
+		// The last sequence has no match.
+		if (ip == iend)
+			break;
+
+		// Match
+		if (iend - ip < 2)
+			return -E_INVAL;
+		off = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (off == 0 || off > op - (uint8_t *) dst)
+			return -E_INVAL;
+		len = token & 15;
+		if (len == 15 && (len = lz4_length(&ip, iend, len)) < 0)
+			return -E_INVAL;
+		len += LZ4_MINMATCH;
+		if (len > oend - op)
+			return -E_INVAL;
+
+		// A match may overlap the bytes it produces (a short
+		// 'off' repeats a pattern), so only copy in bulk if not.
+		match = op - off;
+		if (off >= len) {
+			memmove(op, match, len);
+			op += len;
+		} else
+			while (len-- > 0)
+				*op++ = *match++;
+	}
+	return op - (uint8_t *) dst;
+}
@@ -33,7 +33,7 @@ isfree(void *v, size_t n)
 
 	for (va = (uintptr_t) v; va < end_va; va += PGSIZE)
 		if (va >= (uintptr_t) mend
-		    || ((vpd[PDX(va)] & PTE_P) && (vpt[PGNUM(va)] & PTE_P)))
+		    || ((vpd[PDX(va)] & PTE_P) && (vpt[PGNUM(va)] & (PTE_P|PTE_LAZY))))
 			return 0;
 	return 1;
 }
@@ -41,7 +41,7 @@ isfree(void *v, size_t n)
 void*
 malloc(size_t n)
 {
-	int i, cont;
+	int i;
 	int nwrap;
 	uint32_t *ref;
 	void *v;
@@ -94,14 +94,14 @@ malloc(size_t n)
 
 	/*
 	 * allocate at mptr - the +4 makes sure we allocate a ref count.
+	 * all but the last page are demand-zero, so a big chunk only
+	 * costs memory as it is touched.
 	 */
-	for (i = 0; i < n + 4; i += PGSIZE){
-		cont = (i + PGSIZE < n + 4) ? PTE_CONTINUED : 0;
-		if (sys_page_alloc(0, mptr + i, PTE_P|PTE_U|PTE_W|cont) < 0){
-			for (; i >= 0; i -= PGSIZE)
-				sys_page_unmap(0, mptr + i);
-			return 0;	/* out of physical memory */
-		}
+	i = ROUNDUP(n + 4, PGSIZE);
+	if (sys_page_reserve(0, mptr, i - PGSIZE, PTE_P|PTE_U|PTE_W|PTE_CONTINUED) < 0
+	    || sys_page_alloc(0, mptr + i - PGSIZE, PTE_P|PTE_U|PTE_W) < 0) {
+		sys_page_unmap_range(0, mptr, i);
+		return 0;	/* out of physical memory */
 	}
 
 	ref = (uint32_t*) (mptr + i - 4);
@@ -114,7 +114,7 @@ malloc(size_t n)
 void
 free(void *v)
 {
-	uint8_t *c;
+	uint8_t *c, *start;
 	uint32_t *ref;
 
 	if (v == 0)
@@ -123,11 +123,13 @@ free(void *v)
 
 	c = ROUNDDOWN(v, PGSIZE);
 
+	start = c;
 	while (vpt[PGNUM(c)] & PTE_CONTINUED) {
-		sys_page_unmap(0, c);
 		c += PGSIZE;
 		assert(mbegin <= c && c < mend);
 	}
+	if (c != start)
+		sys_page_unmap_range(0, start, c - start);
 
 	/*
 	 * c is just a piece of this page, so dec the ref count
@@ -5,10 +5,16 @@
 #define UTEMP2			(UTEMP + PGSIZE)
 #define UTEMP3			(UTEMP2 + PGSIZE)
 
+// Where spawn maps the whole program file for sys_env_load.
+#define IMAGE			(UTEMP3 + PGSIZE)
+#define IMAGE_MAXSIZE		(PFTEMP - IMAGE)
+
 // Helper functions for spawn.
 static int init_stack(envid_t child, const char **argv, uintptr_t *init_esp);
+static int map_image(int fd, size_t *size);
 static int map_segment(envid_t child, uintptr_t va, size_t memsz,
 		       int fd, size_t filesz, off_t fileoffset, int perm);
+static envid_t spawn_env(const char *prog, const char **argv, bool snapshot);
 
 // Spawn a child process from a program image loaded from the file system.
 // prog: the pathname of the program to run.
@@ -17,6 +23,51 @@ static int map_segment(envid_t child, uintptr_t va, size_t memsz,
 // Returns child envid on success, < 0 on failure.
 int
 spawn(const char *prog, const char **argv)
+{
+	return spawn_env(prog, argv, 0);
+}
+
+// Spawn prog like spawn does, but freeze the child as a snapshot (see
+// sys_env_snapshot) once libmain has initialized it, so that
+// spawn_clone can start copies of it without loading the program
+// again.  The snapshot lives until it is destroyed with sys_env_destroy.
+// Returns the snapshot's envid on success, < 0 on failure.
+envid_t
+spawn_snapshot(const char *prog, const char **argv)
+{
+	const volatile struct Env *e;
+	envid_t snap;
+
+	if ((snap = spawn_env(prog, argv, 1)) < 0)
+		return snap;
+	e = &envs[ENVX(snap)];
+	while (e->env_snapshot != ENV_SNAP_FROZEN) {
+		if (e->env_id != snap || e->env_status == ENV_FREE ||
+		    e->env_status == ENV_DYING)
+			return -E_BAD_ENV;	// exited before it froze
+		sys_yield();
+	}
+	return snap;
+}
+
+// Start a new child from the snapshot 'snap' made by spawn_snapshot.
+// The child runs umain with the arguments the snapshot was spawned with.
+// Returns child envid on success, < 0 on failure.
+envid_t
+spawn_clone(envid_t snap)
+{
+	envid_t child;
+	int r;
+
+	if ((child = sys_env_clone(snap)) < 0)
+		return child;
+	if ((r = sys_env_set_status(child, ENV_RUNNABLE)) < 0)
+		panic("sys_env_set_status: %e", r);
+	return child;
+}
+
+static envid_t
+spawn_env(const char *prog, const char **argv, bool snapshot)
 {
 	unsigned char elf_buf[512];
 	struct Trapframe child_tf;
@@ -26,6 +77,7 @@ spawn(const char *prog, const char **argv)
 	struct Elf *elf;
 	struct Proghdr *ph;
 	int perm;
+	size_t size = 0;
 
 	// This code follows this procedure:
 	//
@@ -88,18 +140,29 @@ spawn(const char *prog, const char **argv)
 		return r;
 	fd = r;
 
-	// Read elf header
-	elf = (struct Elf*) elf_buf;
-	if (readn(fd, elf_buf, sizeof(elf_buf)) != sizeof(elf_buf)
-	    || elf->e_magic != ELF_MAGIC) {
-		close(fd);
+	// Map the whole file straight from the file server's cache, in as
+	// few IPCs as possible, so that the kernel can build the child
+	// from it with one sys_env_load.  If that fails, fall back to
+	// reading the program page by page.
+	if (map_image(fd, &size) == 0)
+		elf = (struct Elf*) IMAGE;
+	else {
+		size = 0;
+		elf = (struct Elf*) elf_buf;
+		if (readn(fd, elf_buf, sizeof(elf_buf)) != sizeof(elf_buf))
+			elf->e_magic = 0;
+	}
+
+	// Check elf header
+	if (elf->e_magic != ELF_MAGIC) {
 		cprintf("elf magic %08x want %08x\n", elf->e_magic, ELF_MAGIC);
-		return -E_NOT_EXEC;
+		r = -E_NOT_EXEC;
+		goto error_image;
 	}
 
 	// Create new child environment
 	if ((r = sys_exofork()) < 0)
-		return r;
+		goto error_image;
 	child = r;
 
 	// Set up trap frame, including initial stack.
@@ -107,19 +170,27 @@ spawn(const char *prog, const char **argv)
 	child_tf.tf_eip = elf->e_entry;
 
 	if ((r = init_stack(child, argv, &child_tf.tf_esp)) < 0)
-		return r;
+		goto error;
 
 	// Set up program segments as defined in ELF header.
-	ph = (struct Proghdr*) (elf_buf + elf->e_phoff);
-	for (i = 0; i < elf->e_phnum; i++, ph++) {
-		if (ph->p_type != ELF_PROG_LOAD)
-			continue;
-		perm = PTE_P | PTE_U;
-		if (ph->p_flags & ELF_PROG_FLAG_WRITE)
-			perm |= PTE_W;
-		if ((r = map_segment(child, ph->p_va, ph->p_memsz,
-				     fd, ph->p_filesz, ph->p_offset, perm)) < 0)
+	if (size) {
+		r = sys_env_load(child, IMAGE, size);
+		sys_page_unmap_range(0, IMAGE, size);
+		size = 0;
+		if (r < 0)
 			goto error;
+	} else {
+		ph = (struct Proghdr*) (elf_buf + elf->e_phoff);
+		for (i = 0; i < elf->e_phnum; i++, ph++) {
+			if (ph->p_type != ELF_PROG_LOAD)
+				continue;
+			perm = PTE_P | PTE_U;
+			if (ph->p_flags & ELF_PROG_FLAG_WRITE)
+				perm |= PTE_W;
+			if ((r = map_segment(child, ph->p_va, ph->p_memsz,
+					     fd, ph->p_filesz, ph->p_offset, perm)) < 0)
+				goto error;
+		}
 	}
 	close(fd);
 	fd = -1;
@@ -127,6 +198,9 @@ spawn(const char *prog, const char **argv)
 	if ((r = sys_env_set_trapframe(child, &child_tf)) < 0)
 		panic("sys_env_set_trapframe: %e", r);
 
+	if (snapshot && (r = sys_env_snapshot(child)) < 0)
+		goto error;
+
 	if ((r = sys_env_set_status(child, ENV_RUNNABLE)) < 0)
 		panic("sys_env_set_status: %e", r);
 
@@ -134,10 +208,37 @@ spawn(const char *prog, const char **argv)
 
 error:
 	sys_env_destroy(child);
+error_image:
+	if (size)
+		sys_page_unmap_range(0, IMAGE, size);
 	close(fd);
 	return r;
 }
 
+// Map all of the file open on 'fd' read-only at IMAGE, straight from
+// the file server's block cache, and store its size in *size.
+// Returns 0 on success, < 0 on error (-E_NO_MEM if it doesn't fit).
+static int
+map_image(int fd, size_t *size)
+{
+	struct Stat st;
+	off_t off;
+	int r;
+
+	if ((r = fstat(fd, &st)) < 0)
+		return r;
+	if (st.st_size <= 0 || st.st_size > IMAGE_MAXSIZE)
+		return -E_NO_MEM;
+	for (off = 0; off < st.st_size; off += r * PGSIZE)
+		if ((r = fmap(fd, off, ROUNDUP(st.st_size - off, PGSIZE) / PGSIZE,
+			      IMAGE + off)) <= 0) {
+			sys_page_unmap_range(0, IMAGE, off);
+			return r < 0 ? r : -E_INVAL;
+		}
+	*size = st.st_size;
+	return 0;
+}
+
 // Spawn, taking command-line arguments array directly on the stack.
 // NOTE: Must have a sentinal of NULL at the end of the args
 // (none of the args may be NULL).
@@ -270,24 +371,34 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 		fileoffset -= i;
 	}
 
-	for (i = 0; i < memsz; i += PGSIZE) {
-		if (i >= filesz) {
-			// allocate a blank page
-			if ((r = sys_page_alloc(child, (void*) (va + i), perm)) < 0)
-				return r;
-		} else {
-			// from file
-			if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
-				return r;
-			if ((r = seek(fd, fileoffset + i)) < 0)
-				return r;
-			if ((r = readn(fd, UTEMP, MIN(PGSIZE, filesz-i))) < 0)
-				return r;
-			if ((r = sys_page_map(0, UTEMP, child, (void*) (va + i), perm)) < 0)
-				panic("spawn: sys_page_map data: %e", r);
+	for (i = 0; i < filesz; i += PGSIZE) {
+		// Read-only pages are shared with the file server's cache,
+		// and so with every other env running this program, unless
+		// zeroes must follow the file data within the page.
+		if (!(perm & PTE_W) && PGOFF(fileoffset) == 0 &&
+		    (i + PGSIZE <= filesz || memsz <= filesz) &&
+		    fmap(fd, fileoffset + i, 1, UTEMP) == 1) {
+			r = sys_page_map(0, UTEMP, child, (void*) (va + i), perm);
 			sys_page_unmap(0, UTEMP);
+			if (r < 0)
+				return r;
+			continue;
 		}
+		// from file
+		if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+			return r;
+		if ((r = seek(fd, fileoffset + i)) < 0)
+			return r;
+		if ((r = readn(fd, UTEMP, MIN(PGSIZE, filesz-i))) < 0)
+			return r;
+		if ((r = sys_page_map(0, UTEMP, child, (void*) (va + i), perm)) < 0)
+			panic("spawn: sys_page_map data: %e", r);
+		sys_page_unmap(0, UTEMP);
 	}
+	// the blank pages are demand-zero
+	if (i < memsz &&
+	    (r = sys_page_reserve(child, (void*) (va + i), memsz - i, perm)) < 0)
+		return r;
 	return 0;
 }
 
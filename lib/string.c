@@ -1,6 +1,9 @@
-// Basic string routines.  Not hardware optimized, but not shabby.
+// Basic string routines.  Not hardware optimized, but not shabby,
+// except that large copies and fills use SSE2 when the CPU has it.
 
 #include <inc/string.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
 
 // Using assembly for memset/memmove
 // makes some difference on real hardware,
@@ -132,17 +135,93 @@ uint32_t str2hex(const char *s) {
   return hex;
 }
 
+// Set by string_init if the CPU has SSE2 and the kernel enabled it.
+// Kept out of .bss: i386_init clears .bss with memset, which reads
+// this before the boot loader's leftovers in .bss are gone.
+static int string_sse2 __attribute__((section(".data"))) = 0;
+
+// Use SSE2 in memmove and memset if we can.  The kernel calls this
+// once fpu_init_percpu has enabled SSE; libmain calls it for every
+// user environment.
+void
+string_init(void)
+{
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	string_sse2 = (edx & CPUID_FEAT_FXSR) && (edx & CPUID_FEAT_SSE2);
+}
+
 #if ASM
+// Copies and fills of at least this many bytes use SSE2, if present.
+#define SSE2_MIN	128
+
+// Copy n bytes, a multiple of 64, from s to 16-byte aligned d.
+static void
+sse2_copy(char *d, const char *s, size_t n)
+{
+	asm volatile(XMM_SAVE
+		     "1:\n\t"
+		     "movdqu (%1), %%xmm0\n\t"
+		     "movdqu 16(%1), %%xmm1\n\t"
+		     "movdqu 32(%1), %%xmm2\n\t"
+		     "movdqu 48(%1), %%xmm3\n\t"
+		     "movdqa %%xmm0, (%0)\n\t"
+		     "movdqa %%xmm1, 16(%0)\n\t"
+		     "movdqa %%xmm2, 32(%0)\n\t"
+		     "movdqa %%xmm3, 48(%0)\n\t"
+		     "addl $64, %1\n\t"
+		     "addl $64, %0\n\t"
+		     "subl $64, %2\n\t"
+		     "jnz 1b"
+		     XMM_RESTORE
+		     : "+r" (d), "+r" (s), "+r" (n) : : "cc", "memory");
+}
+
+// Fill n bytes, a multiple of 64, at 16-byte aligned d with the
+// byte replicated in w.
+static void
+sse2_fill(char *d, uint32_t w, size_t n)
+{
+	asm volatile(XMM_SAVE
+		     "movd %2, %%xmm0\n\t"
+		     "pshufd $0, %%xmm0, %%xmm0\n"
+		     "1:\n\t"
+		     "movdqa %%xmm0, (%0)\n\t"
+		     "movdqa %%xmm0, 16(%0)\n\t"
+		     "movdqa %%xmm0, 32(%0)\n\t"
+		     "movdqa %%xmm0, 48(%0)\n\t"
+		     "addl $64, %0\n\t"
+		     "subl $64, %1\n\t"
+		     "jnz 1b"
+		     XMM_RESTORE
+		     : "+r" (d), "+r" (n) : "r" (w) : "cc", "memory");
+}
+
 void *
 memset(void *v, int c, size_t n)
 {
 	char *p;
+	size_t head;
 
 	if (n == 0)
 		return v;
-	if ((int)v%4 == 0 && n%4 == 0) {
-		c &= 0xFF;
-		c = (c<<24)|(c<<16)|(c<<8)|c;
+	c &= 0xFF;
+	c = (c<<24)|(c<<16)|(c<<8)|c;
+	if (string_sse2 && n >= SSE2_MIN) {
+		// Byte stores up to a 16-byte boundary, vector stores,
+		// then byte stores for what is left.
+		p = v;
+		head = -(uintptr_t) p & 15;
+		asm volatile("cld; rep stosb\n"
+			: "+D" (p), "+c" (head) : "a" (c) : "cc", "memory");
+		n -= -(uintptr_t) v & 15;
+		sse2_fill(p, c, n & ~63);
+		p += n & ~63;
+		n &= 63;
+		asm volatile("cld; rep stosb\n"
+			: "+D" (p), "+c" (n) : "a" (c) : "cc", "memory");
+	} else if ((int)v%4 == 0 && n%4 == 0) {
 		asm volatile("cld; rep stosl\n"
 			:: "D" (v), "a" (c), "c" (n/4)
 			: "cc", "memory");
@@ -158,6 +237,7 @@ memmove(void *dst, const void *src, size_t n)
 {
 	const char *s;
 	char *d;
+	size_t head;
 	
 	s = src;
 	d = dst;
@@ -172,6 +252,19 @@ memmove(void *dst, const void *src, size_t n)
 				:: "D" (d-1), "S" (s-1), "c" (n) : "cc", "memory");
 		// Some versions of GCC rely on DF being clear
 		asm volatile("cld" ::: "cc");
+	} else if (string_sse2 && n >= SSE2_MIN) {
+		// Each 64-byte block is loaded before any of it is
+		// stored, so this is safe when d overlaps below s.
+		head = -(uintptr_t) d & 15;
+		n -= head;
+		asm volatile("cld; rep movsb\n"
+			: "+D" (d), "+S" (s), "+c" (head) : : "cc", "memory");
+		sse2_copy(d, s, n & ~63);
+		d += n & ~63;
+		s += n & ~63;
+		n &= 63;
+		asm volatile("cld; rep movsb\n"
+			: "+D" (d), "+S" (s), "+c" (n) : : "cc", "memory");
 	} else {
 		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
 			asm volatile("cld; rep movsl\n"
@@ -222,6 +315,65 @@ memmove(void *dst, const void *src, size_t n)
 }
 #endif
 
+// Copy a page-aligned page.  Non-temporal stores keep the destination,
+// which the caller is usually about to hand to someone else, from
+// evicting the rest of the cache.
+void
+pgcopy(void *dst, const void *src)
+{
+	char *d = dst;
+	const char *s = src;
+	size_t n = PGSIZE;
+
+	if (!ASM || !string_sse2) {
+		memmove(dst, src, PGSIZE);
+		return;
+	}
+	asm volatile(XMM_SAVE
+		     "1:\n\t"
+		     "movdqa (%1), %%xmm0\n\t"
+		     "movdqa 16(%1), %%xmm1\n\t"
+		     "movdqa 32(%1), %%xmm2\n\t"
+		     "movdqa 48(%1), %%xmm3\n\t"
+		     "movntdq %%xmm0, (%0)\n\t"
+		     "movntdq %%xmm1, 16(%0)\n\t"
+		     "movntdq %%xmm2, 32(%0)\n\t"
+		     "movntdq %%xmm3, 48(%0)\n\t"
+		     "addl $64, %1\n\t"
+		     "addl $64, %0\n\t"
+		     "subl $64, %2\n\t"
+		     "jnz 1b\n\t"
+		     "sfence"
+		     XMM_RESTORE
+		     : "+r" (d), "+r" (s), "+r" (n) : : "cc", "memory");
+}
+
+// Zero a page-aligned page with non-temporal stores.
+void
+pgzero(void *dst)
+{
+	char *d = dst;
+	size_t n = PGSIZE;
+
+	if (!ASM || !string_sse2) {
+		memset(dst, 0, PGSIZE);
+		return;
+	}
+	asm volatile(XMM_SAVE
+		     "pxor %%xmm0, %%xmm0\n"
+		     "1:\n\t"
+		     "movntdq %%xmm0, (%0)\n\t"
+		     "movntdq %%xmm0, 16(%0)\n\t"
+		     "movntdq %%xmm0, 32(%0)\n\t"
+		     "movntdq %%xmm0, 48(%0)\n\t"
+		     "addl $64, %0\n\t"
+		     "subl $64, %1\n\t"
+		     "jnz 1b\n\t"
+		     "sfence"
+		     XMM_RESTORE
+		     : "+r" (d), "+r" (n) : : "cc", "memory");
+}
+
 /* sigh - gcc emits references to this for structure assignments! */
 /* it is *not* prototyped in inc/string.h - do not use directly. */
 void *
@@ -109,13 +109,26 @@ sys_env_set_pgfault_upcall(envid_t envid, void *upcall)
 int
 sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 {
-	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 0);
+	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 1);
+}
+
+int
+sys_ipc_try_send_pages(envid_t envid, uint32_t value, void *srcva,
+		       size_t npages, int perm)
+{
+	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, npages);
 }
 
 int
 sys_ipc_recv(void *dstva)
 {
-  return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
+  return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 1, 0, 0, 0);
+}
+
+int
+sys_ipc_recv_pages(void *dstva, size_t npages)
+{
+	return syscall(SYS_ipc_recv, 1, (uint32_t) dstva, npages, 0, 0, 0);
 }
 
 unsigned int
@@ -129,3 +142,87 @@ sys_pci_send_pkt(envid_t envid, void *pktva, size_t len)
 {
   return (unsigned int) syscall(SYS_pci_send_pkt, 1, envid, (uint32_t)pktva, len, 0, 0);
 }
+
+int
+sys_env_set_priority(envid_t envid, int sched_class, int weight)
+{
+	return syscall(SYS_env_set_priority, 1, envid, sched_class, weight, 0, 0);
+}
+
+int
+sys_env_register(const char *name)
+{
+	return syscall(SYS_env_register, 0, (uint32_t) name, strlen(name), 0, 0, 0);
+}
+
+int
+sys_page_alloc_range(envid_t envid, void *va, size_t len, int perm)
+{
+	return syscall(SYS_page_alloc_range, 1, envid, (uint32_t) va, len, perm, 0);
+}
+
+int
+sys_page_unmap_range(envid_t envid, void *va, size_t len)
+{
+	return syscall(SYS_page_unmap_range, 1, envid, (uint32_t) va, len, 0, 0);
+}
+
+int
+sys_page_protect(envid_t envid, void *va, size_t len, int perm)
+{
+	return syscall(SYS_page_protect, 1, envid, (uint32_t) va, len, perm, 0);
+}
+
+int
+sys_page_reserve(envid_t envid, void *va, size_t len, int perm)
+{
+	return syscall(SYS_page_reserve, 1, envid, (uint32_t) va, len, perm, 0);
+}
+
+int
+sys_env_set_fault_fill(envid_t envid, void *va, size_t len, void *fillva)
+{
+	return syscall(SYS_env_set_fault_fill, 1, envid, (uint32_t) va, len, (uint32_t) fillva, 0);
+}
+
+int
+sys_cgetc_wait(void)
+{
+	return syscall(SYS_cgetc_wait, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_klog_read(char *buf, size_t len, uint32_t *pos)
+{
+	return syscall(SYS_klog_read, 0, (uint32_t) buf, len, (uint32_t) pos, 0, 0);
+}
+
+int
+sys_env_load(envid_t envid, const void *binary, size_t size)
+{
+	return syscall(SYS_env_load, 1, envid, (uint32_t) binary, size, 0, 0);
+}
+
+int
+sys_env_snapshot(envid_t envid)
+{
+	return syscall(SYS_env_snapshot, 0, envid, 0, 0, 0, 0);
+}
+
+envid_t
+sys_env_clone(envid_t snapid)
+{
+	return syscall(SYS_env_clone, 0, snapid, 0, 0, 0, 0);
+}
+
+int
+sys_irq_wait(int irq)
+{
+	return syscall(SYS_irq_wait, 0, irq, 0, 0, 0, 0);
+}
+
+int
+sys_ide_dma(void *va, size_t len, bool todisk)
+{
+	return syscall(SYS_ide_dma, 0, (uint32_t) va, len, todisk, 0, 0);
+}
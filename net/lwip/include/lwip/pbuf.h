@@ -60,6 +60,8 @@ typedef enum {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** the netif already verified this packet's TCP or UDP checksum */
+#define PBUF_FLAG_CHKSUM_OK 0x02U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -31,6 +31,11 @@ typedef uintptr_t mem_ptr_t;
 #define U32_F	"u"
 #define X32_F	"x"
 
+// Checksums, see chksum.c
+#define LWIP_CHKSUM	jos_chksum
+u16_t jos_chksum(void *dataptr, u16_t len);
+u16_t jos_chksum_copy(void *dst, const void *src, u16_t len);
+
 #define LWIP_PLATFORM_DIAG(x)	cprintf x
 #define LWIP_PLATFORM_ASSERT(x)	panic(x)
 
@@ -0,0 +1,192 @@
+// Internet checksum for lwIP (LWIP_CHKSUM, see cc.h).
+//
+// Both routines return what lwIP's reference lwip_standard_chksum
+// does: the 16-bit one's complement sum of the data, not inverted, in
+// the byte order it is stored in a header.  The sum is independent of
+// byte order (RFC 1071, p3), so it can be accumulated in words as wide
+// as we like and folded down at the end.
+
+#include <inc/types.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <arch/cc.h>
+
+static int chksum_sse2 = -1;
+
+static bool
+have_sse2(void)
+{
+	uint32_t edx;
+
+	if (chksum_sse2 < 0) {
+		cpuid(1, NULL, NULL, NULL, &edx);
+		chksum_sse2 = (edx & CPUID_FEAT_FXSR) && (edx & CPUID_FEAT_SSE2);
+	}
+	return chksum_sse2;
+}
+
+// Sum the 16-bit words in n bytes at s, n a multiple of 64, copying
+// them to d as well unless d is NULL.  Words are widened into four
+// 32-bit lanes; each lane gains two words per 16 bytes, so for n below
+// 64K none of them can overflow.
+static uint32_t
+sse2_sum(void *d, const void *s, size_t n)
+{
+	uint32_t lanes[4];
+
+	// %1 is s in both versions
+#define SSE2_SUM16(off, store)						\
+	"movdqu " #off "(%1), %%xmm0\n\t"				\
+	store								\
+	"movdqa %%xmm0, %%xmm1\n\t"					\
+	"punpcklwd %%xmm3, %%xmm0\n\t"					\
+	"punpckhwd %%xmm3, %%xmm1\n\t"					\
+	"paddd %%xmm0, %%xmm2\n\t"					\
+	"paddd %%xmm1, %%xmm2\n\t"
+
+	if (d)
+		asm volatile(XMM_SAVE
+			     "pxor %%xmm2, %%xmm2\n\t"
+			     "pxor %%xmm3, %%xmm3\n"
+			     "1:\n\t"
+			     SSE2_SUM16(0, "movdqu %%xmm0, (%0)\n\t")
+			     SSE2_SUM16(16, "movdqu %%xmm0, 16(%0)\n\t")
+			     SSE2_SUM16(32, "movdqu %%xmm0, 32(%0)\n\t")
+			     SSE2_SUM16(48, "movdqu %%xmm0, 48(%0)\n\t")
+			     "addl $64, %1\n\t"
+			     "addl $64, %0\n\t"
+			     "subl $64, %2\n\t"
+			     "jnz 1b\n\t"
+			     "movdqu %%xmm2, (%3)"
+			     XMM_RESTORE
+			     : "+r" (d), "+r" (s), "+r" (n)
+			     : "r" (lanes) : "cc", "memory");
+	else
+		asm volatile(XMM_SAVE
+			     "pxor %%xmm2, %%xmm2\n\t"
+			     "pxor %%xmm3, %%xmm3\n"
+			     "1:\n\t"
+			     SSE2_SUM16(0, "")
+			     SSE2_SUM16(16, "")
+			     SSE2_SUM16(32, "")
+			     SSE2_SUM16(48, "")
+			     "addl $64, %1\n\t"
+			     "subl $64, %0\n\t"
+			     "jnz 1b\n\t"
+			     "movdqu %%xmm2, (%2)"
+			     XMM_RESTORE
+			     : "+r" (n), "+r" (s)
+			     : "r" (lanes) : "cc", "memory");
+#undef SSE2_SUM16
+
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+// Sum n bytes at s, n a multiple of 4, as 32-bit words into a 64-bit
+// accumulator, copying them to d unless d is NULL.
+static uint64_t
+word_sum(uint32_t *d, const uint32_t *s, size_t n)
+{
+	uint64_t sum = 0;
+
+	for (; n >= 16; n -= 16, s += 4) {
+		sum += (uint64_t) s[0] + s[1] + s[2] + s[3];
+		if (d) {
+			d[0] = s[0];
+			d[1] = s[1];
+			d[2] = s[2];
+			d[3] = s[3];
+			d += 4;
+		}
+	}
+	for (; n > 0; n -= 4, s++) {
+		sum += *s;
+		if (d)
+			*d++ = *s;
+	}
+	return sum;
+}
+
+// Head and tail bytes are handled like lwIP's algorithm #3: an odd
+// leading byte goes in the high half of t and the final sum is
+// byte-swapped, so that the bulk is summed from an aligned address.
+static u16_t
+chksum(u8_t *d, const u8_t *s, int len)
+{
+	uint64_t sum = 0;
+	u16_t t = 0;
+	int odd = (uintptr_t) s & 1;
+	int n;
+
+	if (odd && len > 0) {
+		((u8_t *) &t)[1] = *s;
+		if (d)
+			*d++ = *s;
+		s++;
+		len--;
+	}
+	if (((uintptr_t) s & 2) && len > 1) {
+		sum += *(const u16_t *) s;
+		if (d) {
+			*(u16_t *) d = *(const u16_t *) s;
+			d += 2;
+		}
+		s += 2;
+		len -= 2;
+	}
+
+	if (len >= 64 && have_sse2()) {
+		n = len & ~63;
+		sum += sse2_sum(d, s, n);
+		if (d)
+			d += n;
+		s += n;
+		len -= n;
+	}
+	n = len & ~3;
+	sum += word_sum((uint32_t *) d, (const uint32_t *) s, n);
+	if (d)
+		d += n;
+	s += n;
+	len -= n;
+
+	if (len > 1) {
+		sum += *(const u16_t *) s;
+		if (d) {
+			*(u16_t *) d = *(const u16_t *) s;
+			d += 2;
+		}
+		s += 2;
+		len -= 2;
+	}
+	if (len > 0) {
+		((u8_t *) &t)[0] = *s;
+		if (d)
+			*d = *s;
+	}
+	sum += t;
+
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	if (odd)
+		sum = ((sum & 0xff) << 8) | ((sum & 0xff00) >> 8);
+	return sum;
+}
+
+u16_t
+jos_chksum(void *dataptr, u16_t len)
+{
+	return chksum(NULL, dataptr, len);
+}
+
+// Copy len bytes from src to dst and return the checksum of them, in
+// one pass over the data.
+u16_t
+jos_chksum_copy(void *dst, const void *src, u16_t len)
+{
+	return chksum(dst, src, len);
+}
@@ -43,9 +43,94 @@
 #include <lwip/stats.h>
 
 #include <netif/etharp.h>
+#include <lwip/ip.h>
 
 #define PKTMAP		0x10000000
 
+/*
+ * Checksums are folded into the copies between pbufs and packet
+ * pages: low_level_input verifies TCP and UDP checksums while it
+ * copies, and low_level_output fills in the TCP checksum, which lwIP
+ * leaves zero (CHECKSUM_GEN_TCP is 0 in lwipopts.h).  A frame's
+ * transport segment is the byte range [lo, hi) of the frame.
+ */
+struct l4sum {
+    int lo, hi;
+    u8_t proto;
+    u32_t sum;
+};
+
+/*
+ * Find the TCP or UDP segment in the Ethernet frame whose first
+ * 'len' bytes are at 'frame', and add its pseudo header to c->sum.
+ * Returns 0 if there is none, or if it is part of an IP fragment,
+ * whose checksum covers other frames too.
+ */
+static int
+l4sum_init(struct l4sum *c, const u8_t *frame, int len)
+{
+    const struct eth_hdr *eth = (const struct eth_hdr *)frame;
+    const struct ip_hdr *ip = (const struct ip_hdr *)(eth + 1);
+    int hlen;
+
+    c->lo = c->hi = 0;
+    if (len < (int)(sizeof(*eth) + IP_HLEN) ||
+	eth->type != htons(ETHTYPE_IP) || IPH_V(ip) != 4)
+	return 0;
+    hlen = IPH_HL(ip) * 4;
+    if (hlen < IP_HLEN || len < (int)sizeof(*eth) + hlen)
+	return 0;
+    if ((IPH_OFFSET(ip) & htons(IP_OFFMASK | IP_MF)) != 0)
+	return 0;
+    c->proto = IPH_PROTO(ip);
+    if (c->proto != IP_PROTO_TCP && c->proto != IP_PROTO_UDP)
+	return 0;
+    c->lo = sizeof(*eth) + hlen;
+    c->hi = sizeof(*eth) + ntohs(IPH_LEN(ip));
+    if (c->hi < c->lo)
+	return c->lo = c->hi = 0;
+
+    c->sum = (ip->src.addr & 0xffff) + (ip->src.addr >> 16) +
+	(ip->dest.addr & 0xffff) + (ip->dest.addr >> 16) +
+	htons((u16_t)c->proto) + htons((u16_t)(c->hi - c->lo));
+    return 1;
+}
+
+/*
+ * Copy the 'len' bytes at frame offset 'off' from src to dst, summing
+ * the ones inside the segment on the way.
+ */
+static void
+l4sum_copy(struct l4sum *c, u8_t *dst, const u8_t *src, int off, int len)
+{
+    int a = off > c->lo ? off : c->lo;
+    int b = off + len < c->hi ? off + len : c->hi;
+    u16_t sum;
+
+    if (a >= b) {
+	memcpy(dst, src, len);
+	return;
+    }
+    memcpy(dst, src, a - off);
+    sum = jos_chksum_copy(dst + (a - off), src + (a - off), b - a);
+    /* A run starting at an odd offset in the segment has its bytes
+       in the other halves of the 16-bit words */
+    if ((a - c->lo) & 1)
+	sum = ((sum & 0xff) << 8) | (sum >> 8);
+    c->sum += sum;
+    memcpy(dst + (b - off), src + (b - off), off + len - b);
+}
+
+static u16_t
+l4sum_fold(struct l4sum *c)
+{
+    u32_t sum = c->sum;
+
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    return ~sum;
+}
+
 struct jif {
     struct eth_addr *ethaddr;
     envid_t envid;
@@ -91,6 +176,13 @@ low_level_output(struct netif *netif, struct pbuf *p)
     char *txbuf = pkt->jp_data;
     int txsize = 0;
     struct pbuf *q;
+    struct l4sum c;
+    int headers;
+
+    /* lwIP puts all the headers in the first pbuf */
+    headers = l4sum_init(&c, p->payload, p->len) && c.proto == IP_PROTO_TCP;
+    if (!headers)
+	c.lo = c.hi = 0;
     for (q = p; q != NULL; q = q->next) {
 	/* Send the data from the pbuf to the interface, one pbuf at a
 	   time. The size of the data in each pbuf is kept in the ->len
@@ -98,10 +190,14 @@ low_level_output(struct netif *netif, struct pbuf *p)
 
 	if (txsize + q->len > 2000)
 	    panic("oversized packet, fragment %d txsize %d\n", q->len, txsize);
-	memcpy(&txbuf[txsize], q->payload, q->len);
+	l4sum_copy(&c, (u8_t *)&txbuf[txsize], q->payload, txsize, q->len);
 	txsize += q->len;
     }
 
+    /* The checksum field was zero while we summed it */
+    if (headers && c.hi <= txsize && c.lo + 18 <= c.hi)
+	*(u16_t *)&txbuf[c.lo + 16] = l4sum_fold(&c);
+
     pkt->jp_len = txsize;
 
     ipc_send(jif->envid, NSREQ_OUTPUT, (void *)pkt, PTE_P|PTE_W|PTE_U);
@@ -129,9 +225,15 @@ low_level_input(void *va)
 
     /* We iterate over the pbuf chain until we have read the entire
      * packet into the pbuf. */
-    void *rxbuf = (void *) pkt->jp_data;
+    u8_t *rxbuf = (u8_t *) pkt->jp_data;
     int copied = 0;
     struct pbuf *q;
+    struct l4sum c;
+    int check;
+
+    check = l4sum_init(&c, rxbuf, len) && c.hi <= len;
+    if (!check)
+	c.lo = c.hi = 0;
     for (q = p; q != NULL; q = q->next) {
 	/* Read enough bytes to fill this pbuf in the chain. The
 	 * available data in the pbuf is given by the q->len
@@ -139,10 +241,15 @@ low_level_input(void *va)
 	int bytes = q->len;
 	if (bytes > (len - copied))
 	    bytes = len - copied;
-	memcpy(q->payload, rxbuf + copied, bytes);
+	l4sum_copy(&c, q->payload, rxbuf + copied, copied, bytes);
 	copied += bytes;
     }
 
+    /* Spare lwIP the second pass over the data.  A bad checksum is
+     * left for lwIP to find, count and drop. */
+    if (check && l4sum_fold(&c) == 0)
+	p->flags |= PBUF_FLAG_CHKSUM_OK;
+
     return p;
 }
 /*
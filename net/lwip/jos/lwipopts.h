@@ -45,6 +45,11 @@ void *memcpy(void *dst, const void *src, size_t n);
 #define TCP_SND_QUEUELEN	(2 * TCP_SND_BUF/TCP_MSS)
 //#define TCP_SND_QUEUELEN	16
 
+// jif computes outgoing TCP checksums as it copies each frame out and
+// checks incoming TCP and UDP ones as it copies them in (see jif.c).
+// UDP datagrams can be fragmented, so lwIP still sums outgoing ones.
+#define CHECKSUM_GEN_TCP	0
+
 // Print error messages when we run out of memory
 #define LWIP_DEBUG	1
 //#define TCP_DEBUG	LWIP_DBG_ON
@@ -0,0 +1,59 @@
+// Check that bss and large malloc chunks are demand-zero: they cost
+// no memory until touched, read back as zero, and fork gives the
+// child its own zero pages.
+
+#include <inc/lib.h>
+
+#define BIGSIZE		(8*1024*1024)
+
+static char big[BIGSIZE];
+
+static uint32_t
+npages(void)
+{
+	return thisenv->env_stats.es_npages;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t before, after;
+	char *p;
+	envid_t child;
+	int i;
+
+	before = npages();
+	for (i = 0; i < BIGSIZE; i += 1024*1024)
+		if (big[i] != 0)
+			panic("big[%d] = %d, want 0", i, big[i]);
+	after = npages();
+	cprintf("bss: %d pages after touching 8 of %d\n",
+		after - before, BIGSIZE / PGSIZE);
+	if (after - before > 8)
+		panic("bss was not demand-zero");
+
+	before = npages();
+	if ((p = malloc(1024*1024)) == 0)
+		panic("malloc failed");
+	p[0] = 1;
+	after = npages();
+	cprintf("malloc: %d pages after touching 1 of %d\n",
+		after - before, 1024*1024 / PGSIZE);
+
+	big[0] = 'p';
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		if (big[PGSIZE] != 0 || big[0] != 'p')
+			panic("child sees wrong bss");
+		big[PGSIZE] = 'c';
+		exit();
+	}
+	while (envs[ENVX(child)].env_id == child &&
+	       envs[ENVX(child)].env_status != ENV_FREE)
+		sys_yield();
+	if (big[PGSIZE] != 0)
+		panic("child's write leaked into the parent");
+
+	cprintf("demandzero: OK\n");
+}
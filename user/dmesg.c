@@ -0,0 +1,22 @@
+// Print the kernel log: everything written to the console recently,
+// including output that scrolled off the screen.
+// The log is copied out before any of it is printed, since printing
+// adds to it.
+
+#include <inc/lib.h>
+
+// At least the kernel's KLOG_SIZE
+static char buf[16384];
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t pos = 0;
+	int n, len = 0;
+
+	binaryname = "dmesg";
+	while (len < sizeof(buf) &&
+	       (n = sys_klog_read(buf + len, sizeof(buf) - len, &pos)) > 0)
+		len += n;
+	sys_cputs(buf, len);
+}
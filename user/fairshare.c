@@ -0,0 +1,80 @@
+// Measure weighted fair-share scheduling.
+// Like user/fairness, but instead of IPC senders competing for one
+// receiver, fork CPU-bound children with different weights and check
+// that each one's share of the loop iterations tracks its weight.
+// The children only compete for one CPU's time when there is one CPU,
+// so with more the shares are printed but not checked.
+
+#include <inc/lib.h>
+
+#define NCHILD		3
+#define RUNMSEC		2000
+#define BATCH		10000
+#define SLACK		8	// Allowed error in a share, in percent
+
+static const int weights[NCHILD] = { 4, 8, 16 };
+
+static void
+spin(unsigned deadline)
+{
+	volatile uint32_t n;
+	uint32_t iters = 0;
+	int i;
+
+	while (sys_time_msec() < deadline) {
+		for (i = 0; i < BATCH; i++)
+			n++;
+		iters++;
+	}
+	ipc_send(thisenv->env_parent_id, iters, 0, 0);
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t who, kids[NCHILD];
+	uint32_t iters[NCHILD], total;
+	unsigned deadline;
+	int i, j, r, ncpu = 0, wsum = 0, share, ideal, bad = 0;
+
+	// Every CPU has an idle env.
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_type == ENV_TYPE_IDLE &&
+		    envs[i].env_status != ENV_FREE)
+			ncpu++;
+	for (i = 0; i < NCHILD; i++)
+		wsum += weights[i];
+
+	deadline = sys_time_msec() + RUNMSEC;
+	for (i = 0; i < NCHILD; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0)
+			spin(deadline);
+		if ((r = sys_env_set_priority(kids[i], ENV_SCHED_FAIR, weights[i])) < 0)
+			panic("sys_env_set_priority: %e", r);
+	}
+
+	total = 0;
+	for (i = 0; i < NCHILD; i++) {
+		r = ipc_recv(&who, 0, 0);
+		for (j = 0; j < NCHILD; j++)
+			if (kids[j] == who)
+				iters[j] = r;
+		total += r;
+	}
+
+	cprintf("fairshare: %d children for %d msec on %d CPU(s)\n",
+		NCHILD, RUNMSEC, ncpu);
+	for (i = 0; i < NCHILD; i++) {
+		share = total ? iters[i] * 100 / total : 0;
+		ideal = weights[i] * 100 / wsum;
+		cprintf("  %08x weight %3d batches %8d share %3d%% ideal %3d%%\n",
+			kids[i], weights[i], iters[i], share, ideal);
+		if (share < ideal - SLACK || share > ideal + SLACK)
+			bad = 1;
+	}
+	if (ncpu == 1 && bad)
+		panic("shares do not track weights");
+}
@@ -0,0 +1,55 @@
+// Measure sequential file throughput through the file server: write
+// a file, sync it to disk, then read it back, in KB per second.
+// Usage: fsbench [kbytes]
+
+#include <inc/lib.h>
+
+static char buf[8192];
+
+static void
+report(const char *what, int kb, unsigned msec)
+{
+	if (msec == 0)
+		msec = 1;
+	cprintf("%-6s %6d KB in %5u ms: %6u KB/s\n", what, kb, msec,
+		kb * 1000 / msec);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int fd, i, r, kb = 1024, n;
+	unsigned t;
+
+	binaryname = "fsbench";
+	if (argc > 1)
+		kb = strtol(argv[1], 0, 0);
+	n = kb * 1024 / sizeof(buf);
+	kb = n * sizeof(buf) / 1024;
+
+	if ((fd = open("/fsbench", O_RDWR | O_CREAT | O_TRUNC)) < 0)
+		panic("open /fsbench: %e", fd);
+
+	t = sys_time_msec();
+	for (i = 0; i < n; i++) {
+		memset(buf, i, sizeof(buf));
+		if ((r = write(fd, buf, sizeof(buf))) != sizeof(buf))
+			panic("write /fsbench: %e", r);
+	}
+	if ((r = sync()) < 0)
+		panic("sync: %e", r);
+	report("write", kb, sys_time_msec() - t);
+
+	seek(fd, 0);
+	t = sys_time_msec();
+	for (i = 0; i < n; i++) {
+		if ((r = readn(fd, buf, sizeof(buf))) != sizeof(buf))
+			panic("read /fsbench: %e", r);
+		if (buf[0] != (char) i || buf[sizeof(buf) - 1] != (char) i)
+			panic("read /fsbench: bad data in block %d", i);
+	}
+	report("read", kb, sys_time_msec() - t);
+
+	close(fd);
+	remove("/fsbench");
+}
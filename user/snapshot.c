@@ -0,0 +1,90 @@
+// Freeze an initialized child as a snapshot, start clones of it, and
+// check that every clone gets a private copy-on-write image of the
+// snapshot.  Also compares the cost of sys_env_clone with fork.
+// Usage: snapshot [clones]
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+static int counter;
+static char buf[4 * PGSIZE];
+
+static void
+waitenv(envid_t id)
+{
+	const volatile struct Env *e = &envs[ENVX(id)];
+
+	while (e->env_id == id && e->env_status != ENV_FREE)
+		sys_yield();
+}
+
+// Runs in every clone, right after the snapshot froze.
+static void
+clone_main(void)
+{
+	thisenv = &envs[ENVX(sys_getenvid())];
+	counter++;
+	buf[sizeof(buf) - 1]++;
+	if (counter != 43 || buf[0] != 1 || buf[sizeof(buf) - 1] != 3)
+		panic("clone %08x sees counter %d, buf %d/%d",
+		      thisenv->env_id, counter, buf[0], buf[sizeof(buf) - 1]);
+	cprintf("clone %08x ok\n", thisenv->env_id);
+}
+
+void
+umain(int argc, char **argv)
+{
+	const volatile struct Env *e;
+	uint64_t t, tclone = 0, tfork = 0;
+	envid_t snap, id;
+	int i, n = 4;
+
+	binaryname = "snapshot";
+	if (argc > 1)
+		n = strtol(argv[1], 0, 0);
+	if (n < 1)
+		n = 1;
+
+	if ((snap = fork()) < 0)
+		panic("fork: %e", snap);
+	if (snap == 0) {
+		counter = 42;
+		buf[0] = 1;
+		buf[sizeof(buf) - 1] = 2;
+		if ((i = sys_env_snapshot(0)) < 0)
+			panic("sys_env_snapshot: %e", i);
+		clone_main();
+		return;
+	}
+
+	e = &envs[ENVX(snap)];
+	while (e->env_snapshot != ENV_SNAP_FROZEN)
+		sys_yield();
+	if (sys_env_set_status(snap, ENV_RUNNABLE) != -E_INVAL)
+		panic("a snapshot could be made runnable");
+
+	for (i = 0; i < n; i++) {
+		t = read_tsc();
+		if ((id = sys_env_clone(snap)) < 0)
+			panic("sys_env_clone: %e", id);
+		tclone += read_tsc() - t;
+		sys_env_set_status(id, ENV_RUNNABLE);
+		waitenv(id);
+	}
+
+	for (i = 0; i < n; i++) {
+		t = read_tsc();
+		if ((id = fork()) < 0)
+			panic("fork: %e", id);
+		if (id == 0)
+			return;
+		tfork += read_tsc() - t;
+		waitenv(id);
+	}
+
+	if (counter != 0 || buf[0] != 0)
+		panic("clones wrote through to the parent");
+	sys_env_destroy(snap);
+	cprintf("%d clones: %llu cycles per clone, %llu per fork\n",
+		n, tclone / n, tfork / n);
+}
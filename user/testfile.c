@@ -108,11 +108,11 @@ umain(int argc, char **argv)
 		panic("open did not fill struct Fd correctly\n");
 	cprintf("open is good\n");
 
-	// Try files with indirect blocks
+	// Try files spanning many blocks
 	if ((f = open("/big", O_WRONLY|O_CREAT)) < 0)
 		panic("creat /big: %e", f);
 	memset(buf, 0, sizeof(buf));
-	for (i = 0; i < (NDIRECT*3)*BLKSIZE; i += sizeof(buf)) {
+	for (i = 0; i < (NEXTENT*3)*BLKSIZE; i += sizeof(buf)) {
       //for (i = 0; i < BLKSIZE; i += sizeof(buf)) {
 		*(int*)buf = i;
 		if ((r = write(f, buf, sizeof(buf))) < 0)
@@ -125,7 +125,7 @@ umain(int argc, char **argv)
     memset(buf, 0, sizeof(buf));
     cprintf("p1\n");
 
-	for (i = 0; i < (NDIRECT*3)*BLKSIZE; i += sizeof(buf)) {
+	for (i = 0; i < (NEXTENT*3)*BLKSIZE; i += sizeof(buf)) {
 	//for (i = 0; i < BLKSIZE; i += sizeof(buf)) {
         //*(int*)buf = i; // not correct ???
 		if ((r = readn(f, buf, sizeof(buf))) < 0)
@@ -0,0 +1,107 @@
+// Show which environments are using the machine, using the
+// per-env accounting the kernel exports in envs[].env_stats.
+// Usage: top [rounds [msec]]
+
+#include <inc/lib.h>
+
+static struct EnvStats last[NENV];
+static envid_t last_id[NENV];
+
+static const char *
+status_name(unsigned status)
+{
+	switch (status) {
+	case ENV_DYING:		return "dying";
+	case ENV_RUNNABLE:	return "runnable";
+	case ENV_RUNNING:	return "running";
+	case ENV_NOT_RUNNABLE:	return "blocked";
+	default:		return "?";
+	}
+}
+
+static uint32_t
+nsyscalls(const volatile struct EnvStats *es)
+{
+	uint32_t n = 0;
+	int i;
+
+	for (i = 0; i < NSYSCALLS; i++)
+		n += es->es_syscalls[i];
+	return n;
+}
+
+static void
+snapshot(void)
+{
+	int i;
+
+	for (i = 0; i < NENV; i++) {
+		last_id[i] = envs[i].env_id;
+		last[i] = *(const struct EnvStats *) &envs[i].env_stats;
+	}
+}
+
+// An env created since the snapshot starts from zero.
+static const struct EnvStats *
+before(int i)
+{
+	static const struct EnvStats zero;
+
+	return envs[i].env_id == last_id[i] ? &last[i] : &zero;
+}
+
+static void
+report(void)
+{
+	const volatile struct Env *e;
+	const volatile struct EnvStats *es;
+	const struct EnvStats *old;
+	uint64_t total = 0, cycles;
+	int i;
+
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_status != ENV_FREE)
+			total += envs[i].env_stats.es_cycles - before(i)->es_cycles;
+	if (total == 0)
+		total = 1;
+
+	cprintf("envid    status    %%cpu  syscalls  faults(cow)    ipc tx/rx  pages\n");
+	for (i = 0; i < NENV; i++) {
+		e = &envs[i];
+		if (e->env_status == ENV_FREE || e->env_type == ENV_TYPE_IDLE)
+			continue;
+		es = &e->env_stats;
+		old = before(i);
+		cycles = es->es_cycles - old->es_cycles;
+		cprintf("%08x %-8s %4d  %8d  %6d(%4d)  %5d/%5d  %5d\n",
+			e->env_id, status_name(e->env_status),
+			(int) (cycles * 100 / total),
+			nsyscalls(es) - nsyscalls(old),
+			es->es_pgfaults - old->es_pgfaults,
+			es->es_cowfaults - old->es_cowfaults,
+			es->es_ipc_sent - old->es_ipc_sent,
+			es->es_ipc_recv - old->es_ipc_recv,
+			es->es_npages);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	int rounds = 3, msec = 1000, i;
+	unsigned until;
+
+	binaryname = "top";
+	if (argc > 1)
+		rounds = strtol(argv[1], 0, 0);
+	if (argc > 2)
+		msec = strtol(argv[2], 0, 0);
+
+	for (i = 0; i < rounds; i++) {
+		snapshot();
+		until = sys_time_msec() + msec;
+		while (sys_time_msec() < until)
+			sys_yield();
+		report();
+	}
+}